@@ -24,16 +24,43 @@ void parse(int argc, const char* argv[], CubeParams& params)
 			.add_options()
 			("e", "Ellipsoidal object shape. Default cuboid.", cxxopts::value<bool>())
 			("dim", "Object dimensions x,y,z", cxxopts::value<std::vector<int>>())
+			("shape", "Object shape. 0 = cuboid/ellipsoid, 1 = cylinder, 2 = superellipsoid. Default 0", cxxopts::value<int>())
+			("e1", "Superellipsoid vertical exponent. Default 1.0", cxxopts::value<double>())
+			("e2", "Superellipsoid horizontal exponent. Default 1.0", cxxopts::value<double>())
 			("p", "Porosity. Default 0.0 (no porosity)", cxxopts::value<double>()->default_value("0.3"))
 			("z", "Pore size. Default 3x3", cxxopts::value<int>()->default_value("3"))
 			("f", "Fixed pore size. Default is randomized pore size [1:Pore size].", cxxopts::value<bool>())
 			("s", "Spherical pore shape. Default cube.", cxxopts::value<bool>())
+			("pore-model", "Pore model. 0 = random pores, 1 = box correlated, 2 = Gaussian correlated (pore size sets the correlation length). Default 0", cxxopts::value<int>())
 			("R", "Don't replace removed cubes.", cxxopts::value<bool>())
 			("o", "Output directory. Default OutputDir.", cxxopts::value<std::string>())
 			("i", "Output processing increment. Default .05 (Write every 5%)", cxxopts::value<double>())
 			("t", "Processing termination. Default 1.0 (Run until 100% completion)", cxxopts::value<double>())
+			("j", "Worker threads for parallel processing. Default 0 (all cores)", cxxopts::value<int>())
+			("sa", "Save the volume vs surface area data (one line per removal, see i for the file writes).", cxxopts::value<bool>())
+			("voids", "Track open and enclosed void after every removal (implies sa, adds enclosed void, enclosed surface and breach columns).", cxxopts::value<bool>())
+			("euler", "Track the Euler characteristic of the solid after every removal (implies sa, adds an Euler characteristic column).", cxxopts::value<bool>())
+			("moments", "Track the shape moments of the solid after every removal (implies sa, adds centroid, principal moment and long axis columns).", cxxopts::value<bool>())
+			("face-age", "Track how long faces stay exposed (writes the face age spectrum at each output increment).", cxxopts::value<bool>())
+			("depth", "Measure the depth of the solid at each output increment (writes a depth histogram).", cxxopts::value<bool>())
+			("fractal", "Add the box-counting dimension of the surface to the surface area data (implies sa, adds a dimension column).", cxxopts::value<bool>())
+			("hull", "Add the convex hull of the surface to the surface area data at each output increment (implies sa, adds hull volume, hull area, sphericity and convexity columns).", cxxopts::value<bool>())
+			("granulometry", "Measure the void and solid size distributions once the pores are made (writes a size distribution).", cxxopts::value<bool>())
+			("granulometry-at", "Consume thresholds to measure the size distributions at too, e.g. 0.25,0.5 (implies granulometry).", cxxopts::value<std::vector<double>>())
+			("granule-max", "Largest box edge of the size distributions. Default 0 (until no box fits)", cxxopts::value<int>())
 			("help", "Print usage")
 			;
+#ifdef WANT_FRAGMENTATION
+		options
+			.add_options()
+			("frag", "Detect fragments at each output increment.", cxxopts::value<bool>())
+			("inc-frag", "Track fragments after every cube removal (implies frag, adds a fragment count column to the sa data).", cxxopts::value<bool>())
+			("timeline", "Write the exact fragmentation timeline (fragment count and splits) after the run.", cxxopts::value<bool>())
+			("pipe-frag", "Detect fragments on snapshots while consume continues (implies frag).", cxxopts::value<bool>())
+			("lineage", "Track fragment identities between increments and write their lineage after the run (implies frag).", cxxopts::value<bool>())
+			("detach", "Consume the fragments in parallel as independent sub-grids once the object breaks apart and no enclosed pore is shared between fragments (implies frag). Ignored with inc-frag, timeline, pipe-frag, lineage, voids, euler, moments, face-age, depth, fractal, hull or granulometry-at.", cxxopts::value<bool>())
+			;
+#endif //#ifdef WANT_FRAGMENTATION
 		auto result = options.parse(argc, argv);
 
 		if (result.count("help"))
@@ -47,6 +74,87 @@ void parse(int argc, const char* argv[], CubeParams& params)
 			params.cuboid = false;
 		}
 
+		if (result.count("shape"))
+		{
+			params.shapeType = result["shape"].as<int>();
+		}
+
+		if (result.count("e1"))
+		{
+			params.shapeE1 = result["e1"].as<double>();
+		}
+
+		if (result.count("e2"))
+		{
+			params.shapeE2 = result["e2"].as<double>();
+		}
+
+		if (result.count("j"))
+		{
+			params.nThreads = result["j"].as<int>();
+		}
+
+		if (result.count("sa"))
+		{
+			params.outputSave = true;
+		}
+
+		if (result.count("voids"))
+		{
+			params.trackVoids = true;
+			params.outputSave = true;
+		}
+
+		if (result.count("euler"))
+		{
+			params.trackEuler = true;
+			params.outputSave = true;
+		}
+
+		if (result.count("moments"))
+		{
+			params.trackMoments = true;
+			params.outputSave = true;
+		}
+
+		if (result.count("face-age"))
+		{
+			params.trackFaceAge = true;
+		}
+
+		if (result.count("depth"))
+		{
+			params.depthStats = true;
+		}
+
+		if (result.count("fractal"))
+		{
+			params.fractalDim = true;
+			params.outputSave = true;
+		}
+
+		if (result.count("hull"))
+		{
+			params.hullStats = true;
+			params.outputSave = true;
+		}
+
+		if (result.count("granulometry"))
+		{
+			params.granulometry = true;
+		}
+
+		if (result.count("granulometry-at"))
+		{
+			params.granulometry = true;
+			params.granuleAt = result["granulometry-at"].as<std::vector<double>>();
+		}
+
+		if (result.count("granule-max"))
+		{
+			params.granuleMax = result["granule-max"].as<int>();
+		}
+
 		if (result.count("p"))
 		{
 			params.porosity = result["p"].as<double>();
@@ -67,6 +175,11 @@ void parse(int argc, const char* argv[], CubeParams& params)
 			params.poreIsCuboid = false;
 		}
 
+		if (result.count("pore-model"))
+		{
+			params.poreModel = result["pore-model"].as<int>();
+		}
+
 		if (result.count("R"))
 		{
 			params.withReplacement = false;
@@ -87,6 +200,42 @@ void parse(int argc, const char* argv[], CubeParams& params)
 			params.outputDir = result["o"].as<std::string>();
 		}
 
+#ifdef WANT_FRAGMENTATION
+		if (result.count("frag"))
+		{
+			params.enableFrag = true;
+		}
+
+		if (result.count("inc-frag"))
+		{
+			params.enableFrag = true;
+			params.incrementalFrag = true;
+		}
+
+		if (result.count("timeline"))
+		{
+			params.fragTimeline = true;
+		}
+
+		if (result.count("pipe-frag"))
+		{
+			params.enableFrag = true;
+			params.pipelineFrags = true;
+		}
+
+		if (result.count("lineage"))
+		{
+			params.enableFrag = true;
+			params.trackFrags = true;
+		}
+
+		if (result.count("detach"))
+		{
+			params.enableFrag = true;
+			params.detachFrags = true;
+		}
+
+#endif //#ifdef WANT_FRAGMENTATION
 		if (result.count("dim"))
 		{
 			const auto values = result["dim"].as<std::vector<int>>();
@@ -143,6 +292,11 @@ void run(CubeParams& params)
 		sprintf(filename, "%s%dx%dx%d.txt", params.cuboid ? "Cuboid" : "Ellipsoid", params.xdim, params.ydim, params.zdim);
 		grid->outputGrid(filename);	// Dump info for doing 3D cube plots
 	}
+	if (params.granulometry)
+	{
+		sprintf(filename, "%s\\%sGranules%dx%dx%dp%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", (int)params.xdim, (int)params.ydim, (int)params.zdim, (int)(params.porosity * 100 + .5));
+		grid->outputGranulometry(filename);	// Pore and feature sizes before consuming
+	}
 	if (params.outputSave)
 	{
 		sprintf(filename, "%s\\%sInfo%dx%dx%dp%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", params.xdim, params.ydim, params.zdim, (int)(params.porosity * 100 + .5));
@@ -160,11 +314,14 @@ void run(CubeParams& params)
 #ifdef WANT_FRAGMENTATION
 		if (params.enableFrag)	// If enabled do fragment detection
 		{
-			grid->detectFragments();
-			if (params.outputSaveFrags)
+			sprintf(filename, "%sFrags%dx%dx%d_%d.txt", params.cuboid ? "Cuboid" : "Ellipsoid", params.xdim, params.ydim, params.zdim, (int)(Threshhold * 100 + .5));
+			if (grid->usePipelinedFragments())
+				grid->queueFragments(params.outputSaveFrags ? filename : NULL);	// Analysed while consume continues
+			else
 			{
-				sprintf(filename, "%sFrags%dx%dx%d_%d.txt", params.cuboid ? "Cuboid" : "Ellipsoid", params.xdim, params.ydim, params.zdim, (int)(Threshhold * 100 + .5));
-				grid->outputFragments(filename);
+				grid->detectFragments();
+				if (params.outputSaveFrags)
+					grid->outputFragments(filename);
 			}
 		}
 #endif //#ifdef WANT_FRAGMENTATION
@@ -173,6 +330,25 @@ void run(CubeParams& params)
 			sprintf(filename, "%s%dx%dx%d_%d.txt", params.cuboid ? "Cuboid" : "Ellipsoid", params.xdim, params.ydim, params.zdim, (int)(Threshhold * 100 + .5));
 			grid->outputGrid(filename);	// Dump info for doing 3D cube plots
 		}
+		if (params.trackFaceAge)
+		{
+			sprintf(filename, "%s\\%sFaceAges%dx%dx%d_%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", (int)params.xdim, (int)params.ydim, (int)params.zdim, (int)(Threshhold * 100 + .5));
+			grid->outputFaceAges(filename);	// Age spectrum of the current and retired surface
+		}
+		if (params.depthStats)
+		{
+			sprintf(filename, "%s\\%sDepths%dx%dx%d_%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", (int)params.xdim, (int)params.ydim, (int)params.zdim, (int)(Threshhold * 100 + .5));
+			grid->outputDepths(filename);	// Distance to the void of the remaining cubes
+		}
+		for (size_t i = 0; i < params.granuleAt.size(); i++)
+		{
+			if (fabs(Threshhold - params.granuleAt[i]) < params.outputInc / 2)
+			{	// The increment nearest the requested threshold
+				sprintf(filename, "%s\\%sGranules%dx%dx%d_%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", (int)params.xdim, (int)params.ydim, (int)params.zdim, (int)(Threshhold * 100 + .5));
+				grid->outputGranulometry(filename);	// Void and solid sizes now
+				break;
+			}
+		}
 		if (params.outputSave)
 		{
 			grid->outputSAData();	// Dump volume vs surface area data
@@ -182,6 +358,9 @@ void run(CubeParams& params)
 		if (Threshhold >= params.outputEnd)	// Reached end of processing 
 			break;
 	}
+#ifdef WANT_FRAGMENTATION
+	grid->finishFragments();	// Wait for the last snapshots
+#endif //#ifdef WANT_FRAGMENTATION
 	std::chrono::duration<double> duration = std::chrono::system_clock::now() - before;
 	printf("Consuming Elapsed Time: %.3lf(s)\n", duration.count());
 
@@ -190,6 +369,21 @@ void run(CubeParams& params)
 		grid->closeSAData();	// Finish write and close volume vs surface area data file
 	}
 
+#ifdef WANT_FRAGMENTATION
+	if (params.fragTimeline)
+	{
+		char splitFilename[128];
+		sprintf(filename, "%s\\%sFragCount%dx%dx%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", (int)params.xdim, (int)params.ydim, (int)params.zdim);
+		sprintf(splitFilename, "%s\\%sFragSplits%dx%dx%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", (int)params.xdim, (int)params.ydim, (int)params.zdim);
+		grid->outputFragmentTimeline(filename, splitFilename);
+	}
+	if (params.trackFrags)
+	{
+		sprintf(filename, "%s\\%sFragLineage%dx%dx%d.txt", params.outputDir.c_str(), params.cuboid ? "Cuboid" : "Ellipsoid", (int)params.xdim, (int)params.ydim, (int)params.zdim);
+		grid->outputFragmentLineage(filename);
+	}
+#endif //#ifdef WANT_FRAGMENTATION
+
 	delete grid;
 }
 
@@ -0,0 +1,86 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// Convex hull of the exposed cubes.
+
+struct HullPoint
+{
+	int x, y, z;
+
+	bool operator<(const HullPoint& p) const { return((z < p.z) || ((z == p.z) && ((y < p.y) || ((y == p.y) && (x < p.x))))); }
+	bool operator==(const HullPoint& p) const { return((x == p.x) && (y == p.y) && (z == p.z)); }
+};
+
+// Quickhull of integer points. The orientation tests are exact (64 bit integers) so coplanar and
+// collinear points need no tolerances: points on a face are left inside.
+class ConvexHull
+{
+public:
+	ConvexHull() { clear(); }
+
+	bool build(const std::vector<HullPoint>& points);	// Returns false if the points don't span 3 dimensions
+	void clear();
+
+	void vertices(std::vector<HullPoint>& points);	// The points the faces are built on (the corners, maybe some points on edges or faces)
+	double volume();
+	double area();
+
+private:
+	struct Face
+	{
+		int		v[3];		// Vertices, counter clockwise seen from outside
+		int		adj[3];		// Face across the edge from v[i] to v[(i + 1) % 3]
+		int64_t	normal[3];	// Outward normal (not normalized)
+		int64_t	offset;		// normal . v[0]
+		std::vector<int> outside;	// Points above the face
+		bool	alive;
+	};
+
+	int64_t height(const Face& face, int point)
+	{
+		const HullPoint& p = m_points[point];
+		return(face.normal[0] * p.x + face.normal[1] * p.y + face.normal[2] * p.z - face.offset);
+	}
+	int addFace(int a, int b, int c);
+	void assign(std::vector<int>& points, const std::vector<int>& faces);	// Moves the points onto the first face they are above
+
+	std::vector<HullPoint>	m_points;
+	std::vector<Face>		m_faces;
+};
+
+struct HullStats
+{
+	double	volume;		// Hull volume (cubes)
+	double	area;		// Hull area (cube faces)
+};
+
+// Hull of the cubes of the given keys (grid offset << keyShift, every corner of each cube counts).
+// The keys are split between nThreads threads. Each thread takes the hull of its part and the
+// hull of the per-thread hull vertices is the hull of the whole.
+void cubeHull(const unsigned long long* keys, size_t count, int keyShift, int xdim, int ydim, unsigned int nThreads, HullStats& stats);
@@ -0,0 +1,50 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+// Exact Euclidean distance transform of the solid.
+
+#define DEPTH_TILE	(16)	// Columns transformed together along y and z (one cache line of squared distances)
+
+// Depth of the solid: the distance from each cube's centre to the centre of the nearest empty cell.
+// Cells outside the grid are empty, so cubes on the grid boundary are at least 1 deep.
+struct DepthStats
+{
+	uint64_t	solid;			// Cubes measured
+	uint64_t	maxDepthSq;		// Square of the largest depth (the maximum inscribed radius)
+	double		meanDepth;
+	std::vector<uint64_t>	histogram;	// Cubes per unit of depth (bin n holds depths from n up to n + 1)
+
+	double maxDepth() { return(sqrt((double)maxDepthSq)); }
+};
+
+// Measures the depth of the occupied voxels of a bit-packed grid (sx*sy*sz bits, x fastest, bit offset&63 of word offset/64).
+// Separable exact transform (Felzenszwalb & Huttenlocher): a scan along x, then the lower envelope of parabolas along y and z.
+// The x and y passes run on z-slices and the z pass on y-rows, split between nThreads threads.
+// Uses 4 bytes per grid cell for the squared distances between the passes.
+void depthTransform(const uint64_t* bits, int64_t sx, int64_t sy, int64_t sz, unsigned int nThreads, DepthStats& stats);
@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Tracks the Euler characteristic of the solid (components - tunnels + cavities) as cubes are removed or inserted.
+// The solid is the union of closed unit cubes. A cube changes the count of vertices, edges and faces of the union
+// only within its 3x3x3 neighborhood, so the change is the sum of a table lookup for each of its 8 corners
+// (the 7 neighbors sharing that corner). The initial value is the sum of a table lookup over every lattice vertex.
+class EulerTracker
+{
+public:
+	EulerTracker();
+
+	// Counts the solid of the grid. solid is the bit-packed solid (x fastest, bit offset&63 of word offset/64)
+	// owned by the caller, who keeps it up to date and calls removeCube()/insertCube() once the cell's bit has changed.
+	void build(int xdim, int ydim, int zdim, const uint64_t* solid);
+	void clear();
+	bool active() { return(m_active); }
+
+	void removeCube(uint64_t offset);	// The cell's bit has just been cleared
+	void insertCube(uint64_t offset);	// The cell's bit has just been set
+
+	int64_t euler() { return(m_euler); }
+
+private:
+	bool isSolid(int x, int y, int z)
+	{
+		if ((x < 0) || (y < 0) || (z < 0) || (x >= m_dims[0]) || (y >= m_dims[1]) || (z >= m_dims[2]))
+			return(false);
+		uint64_t offset = z * m_layerSize + y * m_rowSize + x;
+		return(((m_solid[offset >> 6] >> (offset & 63)) & 1) != 0);
+	}
+	int cornerChange(uint64_t offset);	// 8 x the change from adding the cube at offset (its own state is ignored)
+	void countSolid();
+
+	bool		m_active;
+	int			m_dims[3];
+	uint64_t	m_rowSize, m_layerSize;
+	const uint64_t* m_solid;	// One bit per cell (set for cubes present, shared)
+	int64_t		m_euler;
+
+	int			m_cornerTable[128];	// 8 x the change at one corner of an added cube by the 7 neighbors sharing the corner
+	int			m_vertexTable[256];	// 8 x the contribution of a lattice vertex by its 8 surrounding cells
+};
+
@@ -0,0 +1,71 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+// Residence time spectrum of the exposed faces.
+// A face's age is the number of cubes consumed between its exposure and its retirement (or now for the current surface).
+// Ages are binned by powers of 2: bin 0 holds age 0 and bin n holds ages 2^(n-1) to 2^n - 1.
+// (Age 0 also counts the faces briefly exposed between the cubes of an opened pore while it is removed)
+class FaceAgeSpectrum
+{
+public:
+	FaceAgeSpectrum() { clear(); }
+
+	void start() { clear(); m_active = true; }
+	void clear();
+	bool active() { return(m_active); }
+
+	void retire(uint64_t age)	// A face exposed for age removals was covered or consumed
+	{
+		int bin = ageBin(age);
+		if (bin >= (int)m_retired.size())
+			m_retired.resize(bin + 1, 0);
+		++m_retired[bin];
+	}
+	const std::vector<uint64_t>& retired() { return(m_retired); }
+
+	// Bins the ages of the current surface. exposedSince holds the removal count at which each face was exposed.
+	static void surface(const std::vector<uint64_t>& exposedSince, uint64_t now, std::vector<uint64_t>& hist);
+
+	// Writes a line per bin: first age, last age, current surface faces, retired faces
+	bool output(const char* filename, const std::vector<uint64_t>& current);
+
+	static int ageBin(uint64_t age)
+	{
+		int bin = 0;
+		while (age)
+		{
+			age >>= 1;
+			++bin;
+		}
+		return(bin);
+	}
+
+private:
+	bool					m_active;
+	std::vector<uint64_t>	m_retired;	// Retired faces per age bin
+};
@@ -0,0 +1,76 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Connected component labelling of the fragment grid.
+
+#define LABEL_SLAB_MIN		(8)		// Fewest layers per slab when the grid is labelled in parallel
+#define LABEL_SLAB_LAYERS	(32)	// Most layers per slab (bounds the scratch space of each thread)
+#define RUN_LABEL_DENSITY	(8)		// Label from x-runs when fewer than 1 in RUN_LABEL_DENSITY cells is occupied
+
+inline int bitCount(uint64_t word)
+{
+#ifdef _MSC_VER
+	return((int)__popcnt64(word));
+#else
+	return(__builtin_popcountll(word));
+#endif
+}
+
+// Scratch space of labelOccupancy(). Kept by the caller between detections so the slab buffers are reused.
+struct LabelBuffers
+{
+	std::vector<std::vector<uint8_t>>	slabIn;		// Unpacked occupancy of the slab being labelled (one per thread)
+	std::vector<std::vector<uint32_t>>	slabOut;	// cc3d labels of the slab being labelled (one per thread)
+	std::vector<uint32_t>				layers;		// Labels of the first and last layer of every slab
+	std::vector<uint32_t>				wordRank;	// Occupied cells before each word of the bit grid
+
+	void clear() { slabIn.clear(); slabOut.clear(); layers.clear(); wordRank.clear(); }
+
+	// Index of an occupied cell in raster order (its slot in the labels of labelOccupancy())
+	uint32_t rank(const uint64_t* bits, uint64_t offset) { return(wordRank[offset >> 6] + bitCount(bits[offset >> 6] & ((1ULL << (offset & 63)) - 1))); }
+};
+
+// Labels the occupied voxels of a bit-packed grid (sx*sy*sz bits, x fastest, bit offset&63 of word offset/64).
+// connectivity is 6 (faces), 18 (+edges) or 26 (+vertices).
+// labels receives one label per occupied voxel in raster order (see LabelBuffers::rank()), so no grid sized label space is needed.
+// The grid is cut into z-slabs of at most LABEL_SLAB_LAYERS layers. Each thread unpacks and labels its slabs one at a time with
+// the cc3d kernels, keeping only the boundary layers. Labels touching across the slab boundaries are then joined with a concurrent union-find.
+// Labels are numbered in raster order of first appearance, exactly as the single threaded cc3d labeller numbers them.
+// Returns the number of components.
+size_t labelOccupancy(const uint64_t* bits, int64_t sx, int64_t sy, int64_t sz, size_t maxLabels, int64_t connectivity, unsigned int nThreads, LabelBuffers& buffers, std::vector<uint32_t>& labels);
+
+// Labels occupied cells given by their grid offsets (z*sx*sy + y*sx + x) without touching the empty grid.
+// The cells are bucketed by (y,z) row into x-runs and runs overlapping in the neighboring rows are joined.
+// Time and memory scale with the number of cells and runs rather than the grid volume.
+// labels receives the label of each offset. The numbering matches labelOccupancy().
+// Returns the number of components.
+size_t labelRuns(const uint64_t* offsets, size_t nCells, int64_t sx, int64_t sy, int64_t sz, int64_t connectivity, unsigned int nThreads, uint32_t* labels);
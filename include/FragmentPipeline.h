@@ -0,0 +1,83 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "MultiCube.h"
+
+#ifdef WANT_FRAGMENTATION
+#define PIPELINE_DEPTH		(2)		// Most snapshots waiting for analysis before submit() blocks the consume loop
+#define SNAPSHOT_FACE_BITS	(3)		// Snapshot entry = (grid offset << SNAPSHOT_FACE_BITS) | exposed face count
+
+// Fragment detection on snapshots of the cube list, run on a worker thread while consume() continues.
+// Each snapshot is labelled (labelRuns() or labelOccupancy()), its fragment statistics gathered and the
+// fragment file written. Snapshots are analysed in the order they were submitted so the output is
+// identical to stopping at each threshold and calling detectFragments() and outputFragments().
+class FragmentPipeline
+{
+public:
+	FragmentPipeline(int64_t xdim, int64_t ydim, int64_t zdim, int64_t connectivity, unsigned int nThreads);
+	~FragmentPipeline();
+
+	void submit(std::vector<uint64_t>& cells, const char* filename);	// Takes over the snapshot (cells is left empty). filename may be NULL.
+	void finish();		// Waits until every submitted snapshot has been analysed
+	int fragments();	// Fragment count of the latest analysed snapshot (0 = none yet)
+
+private:
+	struct Job
+	{
+		std::vector<uint64_t>	cells;
+		std::string				filename;
+	};
+
+	void worker();
+	void analyse(Job& job);
+
+	int64_t					m_xdim, m_ydim, m_zdim;
+	int64_t					m_connectivity;
+	unsigned int			m_nThreads;
+
+	std::thread				m_thread;
+	std::mutex				m_lock;
+	std::condition_variable	m_wake;			// Signals the worker (new job or stop)
+	std::condition_variable	m_done;			// Signals the producer (job finished)
+	std::deque<Job>			m_jobs;			// Submitted snapshots (the front one is being analysed)
+	bool					m_stop;
+	int						m_fragments;
+
+	// Worker state (reused between snapshots)
+	std::vector<uint64_t>	m_offsets;
+	std::vector<uint64_t>	m_occupancy;
+	std::vector<uint32_t>	m_labels;
+	std::vector<uint32_t>	m_cellLabels;
+	LabelBuffers			m_buffers;
+	FragmentStats			m_stats;
+};
+#endif //#ifdef WANT_FRAGMENTATION
@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "robin_hood.h"	// Fast and memory efficient hash table
+
+// Gives fragments stable identities across detections by matching the fragments of one detection to the next by shared cubes.
+// For every live cube the caller adds its label at the previous detection and its new label (addOverlap()), then calls match().
+// Each new fragment follows the previous fragment it shares the most cubes with. The piece of a previous fragment sharing
+// the most cubes with it keeps its track, every other piece starts a new track whose parent is that fragment (a split).
+// Previous fragments no new fragment follows have died (consumed or discarded).
+class FragmentTracker
+{
+public:
+	enum { NONE = 0xFFFFFFFF };
+
+	struct Track
+	{
+		uint32_t	parent;		// Track this fragment split from (NONE = present at the first detection)
+		uint64_t	birth;		// Cubes removed when the fragment first appeared
+		uint64_t	death;		// Cubes removed when it was first found gone (NONE while alive)
+		uint64_t	birthSize;	// Size when it first appeared
+		uint64_t	size;		// Size at the latest detection it was part of
+	};
+
+	FragmentTracker() { clear(); }
+	void clear();
+
+	void addOverlap(uint32_t prevLabel, uint32_t newLabel) { ++m_overlap[((uint64_t)prevLabel << 32) | newLabel]; }
+	// Assigns the tracks of the new labels (sizes[label] = cubes with the label, 0 = unused). removed = cubes removed so far.
+	void match(const std::vector<uint32_t>& sizes, uint64_t removed);
+
+	uint32_t track(uint32_t label) { return((label < m_labelTrack.size()) ? m_labelTrack[label] : (uint32_t)NONE); }
+	size_t tracks() { return(m_tracks.size()); }
+	uint64_t splits() { return(m_splits); }
+	// One line per track "id,parent,birth,death,birth size,size" (parent and death -1 when not set)
+	bool output(const char* filename);
+
+private:
+	robin_hood::unordered_flat_map<uint64_t, uint64_t>	m_overlap;		// Cubes shared by (previous label << 32 | new label)
+	std::vector<uint32_t>								m_labelTrack;	// Track of each label of the latest detection
+	std::vector<Track>									m_tracks;
+	uint64_t											m_splits;
+};
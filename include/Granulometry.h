@@ -0,0 +1,53 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Morphological granulometry: size distributions of the solid and the void by openings with growing boxes.
+
+// Size distribution of one phase (the solid or the void).
+// The opening by a box of edge L keeps the cubes that some L x L x L box inside the phase covers,
+// so the size of a cube is the edge of the largest box of the phase that covers it.
+struct SizeDistribution
+{
+	std::vector<uint64_t>	opened;		// opened[L - 1] = cubes covered by boxes of edge L (opened[0] is the phase volume)
+	bool					truncated;	// Stopped at the largest edge asked for (the last size holds all the larger ones)
+
+	uint64_t volume() const { return(opened.empty() ? 0 : opened[0]); }
+	uint64_t sized(size_t edge) const { return(opened[edge - 1] - ((edge < opened.size()) ? opened[edge] : 0)); }	// Cubes of size edge
+	double meanSize() const;	// Volume weighted
+};
+
+// Openings of a bit-packed grid (sx*sy*sz bits, x fastest, as depthTransform()) by boxes with edges 1, 2, 3...
+// up to maxEdge (0 = until no box fits). solid selects the phase: the set bits, or else the clear ones.
+// Cells outside the grid belong to neither phase (the boxes must fit in the grid), nor do the clear bits of within
+// when it's given (same packing as bits).
+// The erosions and dilations are separable ANDs and ORs of shifted copies of a mask padded to whole words per x row:
+// bit shifts along x, row offsets along y and z. The erosion grows by one cube per size and the dilation by an
+// edge L takes log2(L) doubling passes per axis. Each pass is split between nThreads threads.
+// Uses 3 bits per grid cell.
+void granulometry(const uint64_t* bits, const uint64_t* within, int64_t sx, int64_t sy, int64_t sz, bool solid, unsigned int maxEdge, unsigned int nThreads, SizeDistribution& sizes);
@@ -0,0 +1,70 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <stdint.h>
+
+// Shape descriptors of the solid, treated as a body of unit cubes of unit mass
+struct ShapeMoments
+{
+	uint64_t count;			// Cubes in the solid
+	double centroid[3];		// Centre of mass (grid units, the cube at 0,0,0 spans 0 to 1)
+	double inertia[3][3];	// Inertia tensor about the centroid per cube (includes the unit cubes' own inertia)
+	double principal[3];	// Principal moments (eigenvalues of the inertia tensor), smallest first
+	double axes[3][3];		// Principal axes (axes[i] belongs to principal[i]). axes[0] is the long axis of the solid.
+};
+
+// Tracks the zeroth, first and second moments of the solid as cubes are removed or inserted.
+// Each change only adds or subtracts the cube's coordinates from running sums, so the centroid and
+// inertia tensor are available at any time without scanning the grid.
+class MomentTracker
+{
+public:
+	MomentTracker();
+
+	// Sums the solid of the grid. solid is the bit-packed solid (x fastest, bit offset&63 of word offset/64).
+	// The caller calls removeCube()/insertCube() once per change of a cell.
+	void build(int xdim, int ydim, int zdim, const uint64_t* solid);
+	void clear();
+	bool active() { return(m_active); }
+
+	void removeCube(uint64_t offset) { addCube(offset, -1); }	// The cell was solid
+	void insertCube(uint64_t offset) { addCube(offset, 1); }	// The cell was void
+
+	uint64_t count() { return(m_count); }
+	bool getMoments(ShapeMoments& moments);	// Returns false (and zeroes moments) if the solid is empty
+
+private:
+	void addCube(uint64_t offset, int64_t sign);
+
+	bool		m_active;
+	uint64_t	m_rowSize, m_layerSize;
+
+	// Running sums over the cubes present (integer cube indices, so they stay exact)
+	uint64_t	m_count;
+	int64_t		m_sum[3];		// x, y, z
+	int64_t		m_sumSq[3];		// xx, yy, zz
+	int64_t		m_sumCross[3];	// xy, xz, yz
+};
+
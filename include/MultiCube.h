@@ -25,8 +25,21 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
+#include <limits.h>
 
 #include "robin_hood.h"	// Fast and memory efficient hash table
+#include "Voxelizer.h"		// Span based shape generation
+#include "VoidTracker.h"	// Open/enclosed void connectivity
+#include "EulerTracker.h"	// Euler characteristic of the solid
+#include "MomentTracker.h"	// Centroid and inertia tensor of the solid
+#include "FaceAgeSpectrum.h"	// Residence times of the exposed faces
+#include "DistanceTransform.h"	// Depth of the solid
+#include "OccupancyPyramid.h"	// Solid cubes per box (scan skipping and box counting)
+#include "ConvexHull.h"			// Hull of the surface
+#include "Granulometry.h"		// Void and solid size distributions
+#include "FragmentLabeller.h"	// Connected component labelling
+#include "FragmentTracker.h"	// Fragment identity and lineage across detections
 
 #ifdef HAS_WXWIDGETS			// Uses wxWidgets GUI framework
 #define NEED_THREAD_PROTECTION	// GUI version is multi-threaded
@@ -54,7 +67,6 @@ typedef std::vector<Key_t> CubeList;
 typedef std::vector<Cube*> CubePtrs;
 typedef robin_hood::unordered_flat_map<Key_t, Dim_t> CubeMap;
 typedef robin_hood::unordered_flat_map<Cube*, Dim_t> CubePtrsMap;
-typedef robin_hood::unordered_flat_map<uint32_t, CubePtrs> VectorMap;
 
 #ifdef WANT_FRAGMENTATION
 struct Fragment;	// Forward declaration
@@ -71,11 +83,14 @@ struct CubeParams
 		// Shape/Dimensions
 	bool cuboid;
 	unsigned long xdim, ydim, zdim;
+	unsigned long shapeType;	// SHAPE_STANDARD (cuboid flag selects cuboid or ellipsoid), SHAPE_CYLINDER or SHAPE_SUPERELLIPSOID
+	double	shapeE1, shapeE2;	// Superellipsoid exponents (1,1 = ellipsoid)
 		// Porosity Control
 	bool	poreIsFixed;
 	double	porosity;
 	unsigned long poreSize;
 	bool	poreIsCuboid;
+	unsigned long poreModel;	// PORE_RANDOM (individual pores) or PORE_CORRELATED_* (smoothed noise with correlation length poreSize)
 	bool	withReplacement;
 #ifdef RANDOM_REMOVAL
 	bool	naiveRemoval;
@@ -85,6 +100,20 @@ struct CubeParams
 	unsigned long particleSize;
 	bool	replaceEnable;
 
+		// Processing Control
+	unsigned long nThreads;		// Worker threads used by the parallel grid passes (0 = all cores)
+	bool	trackVoids;			// Track void connectivity (open vs enclosed void and surface) after every removal
+								// (4 bytes per grid cell, grids of fewer than 2^32 - 1 cells, see VoidTracker)
+	bool	trackEuler;			// Track the Euler characteristic of the solid after every removal
+	bool	trackMoments;		// Track the centroid and inertia tensor of the solid after every removal
+	bool	trackFaceAge;		// Track how long faces stay exposed (residence time spectrum)
+	bool	depthStats;			// Measure the depth of the solid (distance to the void) at each output increment
+	bool	fractalDim;			// Add the box-counting dimension of the surface to the SA data
+	bool	hullStats;			// Add the convex hull of the surface to the SA data at each output increment
+	bool	granulometry;		// Measure the void and solid size distributions once the pores are made
+	std::vector<double> granuleAt;	// Consume thresholds to measure them at too
+	unsigned long granuleMax;	// Largest box edge of the size distributions (0 = until no box fits)
+
 		// Data Output Control
 	double	outputInc;
 	double	outputEnd;
@@ -127,6 +156,11 @@ struct CubeParams
 	unsigned long fragClass;
 	bool	outputSaveFrags;
 	unsigned long fragmentAt;
+	bool	incrementalFrag;	// Track fragments after every cube removal instead of relabelling the grid at each increment
+	bool	fragTimeline;		// Record the removal order so the exact fragmentation history can be rebuilt after the run
+	bool	pipelineFrags;		// Detect fragments on snapshots taken at each increment while consume continues
+	bool	trackFrags;			// Match fragments between detections to keep stable ids and their lineage
+	bool	detachFrags;		// Consume the fragments as independent sub-grids in parallel once the object breaks apart (and no pore is shared)
 #endif //#ifdef WANT_FRAGMENTATION
 };
 
@@ -140,32 +174,68 @@ struct SAData
 #endif //#ifdef RANDOM_REMOVAL
 };
 
+// Optional columns of the SA data. They're kept beside saData (one entry per sample) and only filled
+// when their option is on, so runs without them don't pay for them.
+struct VoidSample
+{
+	Dim_t nEnclosedVoid;		// Void not connected to the exterior
+	Dim_t nEnclosedFaces;		// Surface of the enclosed void
+	Dim_t nBreaches;			// Cavities opened to the exterior so far
+};
+
+struct ShapeSample
+{
+	double centroid[3];			// See ShapeMoments
+	double principal[3];
+	double longAxis[3];
+};
+
+struct HullSample
+{
+	double volume;				// Convex hull of the surface (output increments only, 0 elsewhere)
+	double area;
+	double sphericity;			// Area of the sphere of the same volume / surface area
+	double convexity;			// Volume / hull volume
+};
+
 // Internal Cube parameters 
 struct Cube
 {
-	// 32 bits = ffffffffffffffffffffffreeeeeeccc 
-	//	f = frag 22 bits, r = removed 1 bit, e = exposed 6 bits, c = count 3 bits
-	Info_t	info;	// Fragment Id + 
-					// removed flag + 
+	// 10 bits = reeeeeeccc 
+	//	r = removed 1 bit, e = exposed 6 bits, c = count 3 bits
+	// (Fragment ids are kept apart from the cubes, see MultiCube::getFragmentId())
+	Info_t	info;	// removed flag + 
 					// bit set indicating presence of adjacent cube (0 if no adjacent cube) + 
 					// exposed face count
-
-#ifdef WANT_FRAGMENTATION
-	int fragId;		// Previous fragment this cube was part of. (Used for fragment animation)
-#endif //#ifdef WANT_FRAGMENTATION
 };
 
 //#ifdef WANT_INPUT_CONTROL
 
 struct point3d {
 	double x, y, z;
-	std::vector<int>	neighbors;
 };
 
 typedef std::vector<point3d> pointVect;
 
 //#endif //#ifdef WANT_INPUT_CONTROL
 
+// Fragment membership in compressed sparse row form (built by a counting sort on the cube labels).
+// The cubes of fragment f are cubes[start[f]] .. cubes[start[f+1]-1]. Label 0 (background) is always empty.
+struct FragmentTable
+{
+	std::vector<Dim_t>	start;		// First cube of each label (label count + 1 entries)
+	CubePtrs			cubes;		// Member cubes grouped by label (cube list order within a label)
+	uint32_t			nFragments;	// Labels with at least one cube
+
+	FragmentTable() : nFragments(0) {}
+	void clear() { start.clear(); cubes.clear(); nFragments = 0; }
+	size_t size() { return(nFragments); }
+	uint32_t labels() { return(start.empty() ? 0 : (uint32_t)start.size() - 1); }
+	Dim_t count(uint32_t f) { return(start[f + 1] - start[f]); }
+	Cube** begin(uint32_t f) { return(cubes.data() + start[f]); }
+	Cube** end(uint32_t f) { return(cubes.data() + start[f + 1]); }
+};
+
 #ifdef WANT_FRAGMENTATION
 struct Fragment
 {
@@ -175,6 +245,72 @@ struct Fragment
 	double minY, maxY;
 	double minZ, maxZ;
 };
+
+// Per fragment aggregates gathered in the pass that assigns the fragment ids (arrays indexed by fragment id)
+struct FragmentStats
+{
+	std::vector<Dim_t>	size;				// Cubes in the fragment
+	std::vector<int>	minX, minY, minZ;	// Bounding box
+	std::vector<int>	maxX, maxY, maxZ;
+	std::vector<Dim_t>	sumX, sumY, sumZ;	// Position sums (centroid = sum / size)
+	std::vector<Dim_t>	exposedFaces;		// Exposed faces of the fragment's cubes
+	std::vector<Dim_t>	exposedCubes;		// Cubes of the fragment with at least one exposed face
+
+	void reset(uint32_t nLabels)
+	{
+		size.assign(nLabels + 1, 0);
+		minX.assign(nLabels + 1, INT_MAX); minY.assign(nLabels + 1, INT_MAX); minZ.assign(nLabels + 1, INT_MAX);
+		maxX.assign(nLabels + 1, INT_MIN); maxY.assign(nLabels + 1, INT_MIN); maxZ.assign(nLabels + 1, INT_MIN);
+		sumX.assign(nLabels + 1, 0); sumY.assign(nLabels + 1, 0); sumZ.assign(nLabels + 1, 0);
+		exposedFaces.assign(nLabels + 1, 0);
+		exposedCubes.assign(nLabels + 1, 0);
+	}
+	void add(uint32_t f, int x, int y, int z, int nFaces)
+	{
+		++size[f];
+		if (x < minX[f]) minX[f] = x;
+		if (x > maxX[f]) maxX[f] = x;
+		if (y < minY[f]) minY[f] = y;
+		if (y > maxY[f]) maxY[f] = y;
+		if (z < minZ[f]) minZ[f] = z;
+		if (z > maxZ[f]) maxZ[f] = z;
+		sumX[f] += x; sumY[f] += y; sumZ[f] += z;
+		exposedFaces[f] += nFaces;
+		if (nFaces)
+			++exposedCubes[f];
+	}
+	void merge(FragmentStats& other)
+	{
+		for (size_t f = 0; f < size.size(); f++)
+		{
+			if (other.size[f] == 0)
+				continue;
+			size[f] += other.size[f];
+			minX[f] = std::min(minX[f], other.minX[f]); maxX[f] = std::max(maxX[f], other.maxX[f]);
+			minY[f] = std::min(minY[f], other.minY[f]); maxY[f] = std::max(maxY[f], other.maxY[f]);
+			minZ[f] = std::min(minZ[f], other.minZ[f]); maxZ[f] = std::max(maxZ[f], other.maxZ[f]);
+			sumX[f] += other.sumX[f]; sumY[f] += other.sumY[f]; sumZ[f] += other.sumZ[f];
+			exposedFaces[f] += other.exposedFaces[f];
+			exposedCubes[f] += other.exposedCubes[f];
+		}
+	}
+	uint32_t labels() { return(size.empty() ? 0 : (uint32_t)size.size() - 1); }
+	double centroidX(uint32_t f) { return((double)sumX[f] / size[f]); }
+	double centroidY(uint32_t f) { return((double)sumY[f] / size[f]); }
+	double centroidZ(uint32_t f) { return((double)sumZ[f] / size[f]); }
+
+	void order(std::vector<uint32_t>& ids);
+	bool output(const char* filename);
+};
+
+class FragmentPipeline;
+
+// One removal of a detached fragment (see MultiCube::detachFragments())
+struct DetachedStep
+{
+	double	time;	// Removal time on the fragment's own clock (exponential waits at a rate equal to its surface area)
+	int		delta;	// Surface area gained (or lost) by the removal
+};
 #endif //#ifdef WANT_FRAGMENTATION
 
 // Map Key  
@@ -184,17 +320,24 @@ struct Fragment
 #define FACE_COUNT_MASK		(0x00000007UL)	// Face count bits 
 #define BITMASK_OFFSET		(0x00000008UL)
 #define EXPOSED_MASK		(0x000001F8UL)	// 6 face state bits (exposed or hidden)
-#define INFOMASK			(0x000003FFUL)	// Everything but the fragment id
 #define SETVISIBLE			(0x00000200UL)	// 1 inserted state bit
 #define CLRVISIBLE			(~SETVISIBLE)
 // Fragment Id
-#define FRAGMENTMASK		(~INFOMASK)		// Everything but the info bits
-#define MAXFRAGS			(0x3FFFFF)
-#define FRAGMENT_ID_SHIFT	(14)
+#define MAXFRAGS			(0xFFFFFFFFUL)	// 32 bit labels (the labeller also caps the provisional labels at the voxel count)
 // Misc.
 #define MAX_COLOR_INDEX		(5)				// 0 - MAX_COLOR_INDEX colors available
 #define POROSITY_PROCESSING_INC	(0.2)		// Show intermediate progress during porosity phase every POROSITY_PROCESSING_INC cubes removed
 #define REMOVED				(0xFFFFFFFFFFFFFFFFULL)
+#define BULK_INSERT_MIN		(0x10000)		// Span insertions of at least this many cubes are done with the parallel bulk writer
+// Shape Types
+#define SHAPE_STANDARD		(0)				// Cuboid or ellipsoid (see CubeParams::cuboid)
+#define SHAPE_CYLINDER		(1)				// Elliptic cylinder along z
+#define SHAPE_SUPERELLIPSOID (2)			// Superellipsoid (see CubeParams::shapeE1/shapeE2)
+// Pore Models
+#define PORE_RANDOM			(0)				// Pores of poreSize placed one at a time
+#define PORE_CORRELATED_BOX	(1)				// Box filtered noise field thresholded to the porosity
+#define PORE_CORRELATED_GAUSSIAN (2)		// Gaussian filtered noise field thresholded to the porosity
+#define FIELD_HISTOGRAM_BINS (0x10000)		// Resolution of the noise field histogram used to find the porosity threshold
 // Macros
 #define getPosition(x)		(x >> POSITION_SHIFT)
 #define clearFaceBit(x, f)	(x &= ~(BITMASK_OFFSET << f))
@@ -208,7 +351,6 @@ struct Fragment
 #define getFace(x)			(x & FACE_MASK)
 #define getFaceCount(x)		(x & FACE_COUNT_MASK)
 #define clearFaceCount(x)	(x &= ~FACE_COUNT_MASK)
-#define getFragmentId(x)	(x >> FRAGMENT_ID_SHIFT)
 #define opFace(x)			(5 - x)		// Faces are numbered like a die (0 opposite 5, 1 opposite 4, etc.)
 
 class MultiCube
@@ -239,6 +381,17 @@ public:
 
 	int detectFragments(bool init= false);
 	int discardFragments();
+#ifdef WANT_FRAGMENTATION
+	bool outputFragmentTimeline(char* countFile, char* splitFile);
+
+	// Pipelined fragment detection (see FragmentPipeline)
+	bool usePipelinedFragments();
+	void queueFragments(char* filename);	// Snapshot the cube list for analysis while consume continues (filename = NULL for no output)
+	int pipelinedFragments();				// Fragment count of the latest analysed snapshot
+	void finishFragments();					// Wait until the queued snapshots have been analysed
+
+	bool outputFragmentLineage(char* filename);	// Write the fragment tracks (see FragmentTracker::output())
+#endif //#ifdef WANT_FRAGMENTATION
 
 #ifdef WANT_FRAGMENTATION
 	std::vector<double>		dhist;
@@ -248,6 +401,14 @@ public:
 	Dim_t getVolume(Dim_t* surfaceArea = NULL);	// The current cube count of the object (+ exposed surface count if requested)
 	Dim_t getInitialVolume();					// The cube count of the 3D object before processing
 	Dim_t getRemovedCount();
+	bool getShapeMoments(ShapeMoments& moments);	// Shape of the solid now (false if moments aren't tracked or the solid is empty)
+	bool getFaceAges(std::vector<uint64_t>& current, std::vector<uint64_t>& retired);	// Age spectra (see FaceAgeSpectrum), false if not tracked
+	bool outputFaceAges(char* filename);
+	void getDepthStats(DepthStats& stats);	// Distance transform of the current solid (see depthTransform())
+	bool outputDepths(char* filename);
+	void getHullStats(HullStats& stats);	// Convex hull of the exposed cubes (see cubeHull())
+	void getGranulometry(SizeDistribution& voids, SizeDistribution& solid);	// Openings by growing boxes (see granulometry())
+	bool outputGranulometry(char* filename);
 
 	CubeParams	m_params;	// Configuration parameter interface to MultiCube class.
 
@@ -271,27 +432,47 @@ private:
 	enum { UNINITIALIZED = 0, NUMFACES = 6 };
 
 	void generateCuboid();
+	void generateShape();
 	Dim_t generateEllipsoid(int x0, int y0, int z0, int width, int height, int depth, bool remove=false, bool countOnly=false);
-	void generateEllipse(int x0, int y0, int zpos, double zcomp, int width, int height, bool remove, bool countOnly);
+	void ellipsoidSpans(int x0, int y0, int z0, int width, int height, int depth, SpanList& spans);
+	void generateEllipse(int x0, int y0, int zpos, double zcomp, int width, int height, SpanList& spans);
+	Dim_t insertSpans(const SpanList& spans);
+	Dim_t stampParticles(const pointVect& points, int size);
+	void removeSpans(const SpanList& spans, int dx=0, int dy=0, int dz=0);
+	void refreshFaces(Cube* cube, int x, int y, int z);
 #ifdef WANT_INPUT_CONTROL
 	void importObject(char* fname);
 #endif //#ifdef WANT_INPUT_CONTROL
 
+	void initMembers();
 	void initialize();
 	void cleanup();
+	double nextRandom();
 
 	// Consumer simulation
 	void preprocess(char* fname);
 	void resetExpectedVolume(Dim_t expectedVolume);
 	void removePore(Cube* cube, int poreSize);
-	void removeCube();
-	void removeCube(Cube* cube);
+	const SpanList& getPoreTemplate(int poreSize);
+	Dim_t generateCorrelatedPores(Dim_t cubesToRemove);
+	Cube* removeCube();
+	Cube* removeCube(Cube* cube);
 	void removeCube(int x, int y, int z);
 	Cube* insertCube(int x, int y, int z, bool doUpdate=false);
 	void deleteCube(Cube* cube);
+	void markRemoved(Cube* cube);
 #ifdef RANDOM_REMOVAL
-	void naiveRemoveCube();
+	Cube* naiveRemoveCube();
 #endif //#ifdef RANDOM_REMOVAL
+	void startVoidTracking();
+	void startEulerTracking();
+	void startMomentTracking();
+	void startFaceAgeTracking();
+	void addSAData(Dim_t surfaceArea, bool fastRemove);
+	void measureHull(HullSample& hull, Dim_t surfaceArea);
+	const uint64_t* solidBits(std::vector<uint64_t>& solid);
+	const uint64_t* shareSolidBits();
+	Dim_t nextOccupied(Dim_t offset, Dim_t& end);	// Skips the empty boxes of the occupancy pyramid (see OccupancyPyramid::nextOccupied())
 	void getBounds(int pos, int poreSz, int& start, int& end, int boundry);
 	int getPoreSize(Dim_t cubesToRemove);
 
@@ -307,6 +488,8 @@ private:
 	void replaceCubes(int nCubes, bool excludeSurface=true);
 	void addToCubeList(Cube* cube);
 	void removeFromCubeList(Cube* cube);
+	void compactExposedList(std::vector<Dim_t>& holes);
+	void compactCubeList(std::vector<Dim_t>& holes);
 	void setupCubeList();
 	void updateCubeList();
 
@@ -324,14 +507,39 @@ private:
 	Dim_t getSize();				// The total cube count of the 3D grid (x*y*z)
 
 	// Fragment handling
-	void sortFragments(std::vector<CubePtrs*>& fragmentList);
+	uint32_t getFragmentId(Cube* cube) { return(m_fragIds.empty() ? (uint32_t)UNINITIALIZED : m_fragIds[getOffset(cube)]); }
+	void setFragmentId(Cube* cube, uint32_t fragment) { m_fragIds[getOffset(cube)] = fragment; }
+	void sortFragments(std::vector<uint32_t>& fragmentList);
 	void initLabels();
+	void releaseLabels();
+	int64_t fragmentConnectivity();
 	void assignFragmentIds(bool init);
+	void buildFragmentTable(const uint32_t* labels, uint32_t nLabels);
 
 #ifdef WANT_FRAGMENTATION
 	void getHistogram();
 	void flow_simulator();
-	Fragment getBoundingBox(CubePtrs& cubeVec, Fragment* prevFrag);
+	Fragment getBoundingBox(uint32_t fragment, Fragment* prevFrag);
+
+	// Incremental fragment tracking
+	bool useIncrementalFragments();
+	void seedFragments();
+	void updateFragments(Cube* removedCube);
+	void collectFragments(bool init);
+	int getFragmentNeighbors(Cube* cube, Cube** neighbors);
+	uint32_t newFragmentId();
+	void releaseFragmentId(uint32_t fragmentId);
+	void buildFragmentNeighbors();
+
+	// Fragmentation timeline
+	void startTimeline();
+
+	// Detached fragment consumption
+	MultiCube(MultiCube& parent, uint32_t fragment, uint64_t seed);	// Compact sub-grid holding a single fragment (and its pores)
+	bool useDetachedFragments();
+	bool fragmentsSharePores();
+	void detachFragments();
+	void consumeDetached(std::vector<DetachedStep>& steps);
 #endif //#ifdef WANT_FRAGMENTATION
 
 	// Member variables
@@ -344,7 +552,6 @@ private:
 	Dim_t	m_initialRemoved;
 	Dim_t	m_maxSurfaceArea;
 	Dim_t	m_cubesRemoved;
-	Dim_t	m_insertionCount;
 	Dim_t	m_particlesGenerated;
 
 	double	m_ellipse_scalar;
@@ -352,6 +559,7 @@ private:
 	bool*	m_doneFlag;		// Used to test for user request to stop processing
 	FILE*	m_saData_fp;	// For Surface Area data output
 	Dim_t	m_lastRemoved;
+	uint64_t m_rngState;	// Private random stream (0 = the shared generator)
 
 #ifdef	NEED_THREAD_PROTECTION
 	// Multi-thread access protection
@@ -360,6 +568,7 @@ private:
 
 	CubeMap						exposedMap;		// Exposed faces map
 	CubeList					exposedList;	// Exposed faces list (for fast lookup on removal)
+	std::vector<uint64_t>		exposedSince;	// Removal count at which each exposed face was exposed (parallel to exposedList, face age tracking only)
 	CubePtrs					cubeList;		// Active cube list (for fast access for display)
 #ifdef USE_CUBE_MAP
 	CubePtrsMap					cubeMap;		// Provides fast access to cube list (avoids slow vector:find())
@@ -368,21 +577,64 @@ private:
 #endif //#ifdef USE_CUBE_MAP
 	CubeMap						surfaceMap;		// Exposed faces map for original surface of shape (used for block replacement)
 	std::vector<SAData>			saData;	// Volume and Surface Area information acquired during consume() phase
-
-	bool*					m_in_labels;
-	uint32_t*				m_out_labels;
-
-	VectorMap				fragments;		// Fragment list. (Stores vectors of cubes mapped by fragment id)
+	std::vector<int>			saFragments;	// Optional columns of saData (see addSAData())
+	std::vector<VoidSample>		saVoids;
+	std::vector<int64_t>		saEuler;
+	std::vector<ShapeSample>	saShapes;
+	std::vector<double>			saSurfaceDims;
+	std::vector<HullSample>		saHulls;
+
+	VoidTracker					m_voids;			// Open/enclosed void connectivity (see CubeParams::trackVoids)
+	bool						m_cavityBreached;	// Set when a removal opens an enclosed cavity to the exterior
+	EulerTracker				m_euler;			// Euler characteristic of the solid (see CubeParams::trackEuler)
+	MomentTracker				m_moments;			// Centroid and inertia tensor of the solid (see CubeParams::trackMoments)
+	FaceAgeSpectrum				m_faceAges;			// Residence times of the exposed faces (see CubeParams::trackFaceAge)
+	OccupancyPyramid			m_pyramid;			// Solid cubes per box (built with the shape for fractalDim, depthStats and outputSaveGrid)
+	std::vector<uint64_t>		m_solidBits;		// The solid bit-packed, shared by the Euler and moment trackers and the pyramid (empty while none is kept)
+	std::vector<uint64_t>		m_shapeBits;		// The solid before the pores are made (granulometry only, see getGranulometry())
+
+	std::vector<uint64_t>	m_occupancy;	// Bit-packed labeller input (one bit per grid cell, cleared after each use)
+	LabelBuffers			m_labelBuffers;	// Labeller scratch space reused between detections
+	std::vector<uint32_t>	m_cubeLabels;	// Label of each cube on the cube list
+	std::vector<uint32_t>	m_fragIds;		// Fragment id of each grid cell (allocated by the first detection)
+
+	FragmentTable			fragments;		// Fragment list. (Cubes of each fragment by fragment id)
 	std::vector<uint32_t>	fragmentSizes;
+#ifdef WANT_FRAGMENTATION
+	FragmentStats			m_fragStats;	// Size, extent and exposure of each fragment (filled with the fragment table)
+	FragmentPipeline*		m_fragPipeline;	// Snapshot analysis worker (see CubeParams::pipelineFrags)
+	FragmentTracker			m_fragTracker;	// Fragment identities across detections (see CubeParams::trackFrags)
+#endif //#ifdef WANT_FRAGMENTATION
 
 	pointVect				m_aggPoints;
 
+	std::map<int, SpanList>	m_poreTemplates;	// Spherical pore spans (relative to the pore centre) by pore size
+
 #ifdef WANT_FRAGMENTATION
 	FragmentMap			fragMap;		// List of fragment attributes
 
+	std::vector<uint32_t> m_prevFragIds;	// Previous fragment each cell was part of. (Used for fragment animation)
 	int					m_lastFragmentId;
 	int					m_lastIndex;
 	Fragment			m_lastFragInfo;
+
+	bool				m_fragsSeeded;		// Fragment ids are valid and maintained after every removal
+	int					m_liveFragments;	// Fragments currently present
+	std::vector<uint32_t> m_freeFragIds;	// Ids of fragments that have vanished (reused before new ids are created)
+	std::vector<int>	m_fragNeighbors;	// Neighbor offsets (dx,dy,dz triplets) for the selected fragment connectivity
+	robin_hood::unordered_flat_map<Cube*, int>	m_fragVisited;	// Search each cube was reached by during a split check
+	std::vector<CubePtrs> m_fragSearches;	// Cubes reached by each search (unprocessed from m_fragHeads onward)
+	std::vector<size_t>	m_fragHeads;
+
+	bool				m_recordRemovals;	// Log every deleted cube (fragmentation timeline)
+	std::vector<Dim_t>	m_timelineStart;	// Offsets of the cubes present when the log was started
+	std::vector<Dim_t>	m_removalLog;		// Offsets of the deleted cubes in removal order
+
+	bool				m_detachReady;		// The last detection found fragments to detach (see detachFragments())
+	bool				m_detachDeferred;	// Detaching was held back by shared pores (reported once)
+	std::vector<int>	m_detachedSteps;	// Surface area change of each detached removal in merged clock order
+	size_t				m_detachedNext;		// Next step to replay
+	Dim_t				m_detachedSurface;	// Surface area of the detached fragments still present
 #ifdef	NEED_THREAD_PROTECTION
 	PortCriticalSection	m_fragProtect;
 #endif
@@ -392,7 +644,7 @@ private:
 class Aggregate
 {
 public:
-	Aggregate(bool isCuboid, double xd, double yd, double zd, double pd);
+	Aggregate(bool isCuboid, double xd, double yd, double zd, double pd, unsigned int nThreads=1);
 
 	pointVect&	getParticles() { return(m_points); }
 	void generateParticles(bool verbose=true);
@@ -403,13 +655,22 @@ public:
 	uint64_t	m_expected;
 
 private:
-	point3d generateParticle(int& index);
-	bool validateParticle(point3d p, double pMag, int index);
+	void generateParticlesBatched(bool verbose);
+	point3d placeParticle(const double* r, int nPoints, int& index);
+	bool validateParticle(point3d p, double pMag, int index, int first=0);
 	void updateParticleNeighbors(point3d& p);
+	int  getCell(const point3d& p, int& cx, int& cy, int& cz);
 
 	bool		m_isCuboid;
 	double		m_xd, m_yd, m_zd;
 	double		m_xr, m_yr, m_zr;
 	double		m_pd, m_pr;
 	pointVect	m_points;
+	unsigned int m_nThreads;
+
+	// Uniform grid spatial index over the particle centers (cell size >= the overlap distance)
+	double				m_cellSize;
+	int					m_cellDims[3];
+	std::vector<int>	m_cellHead;	// First particle in each cell (-1 if empty)
+	std::vector<int>	m_cellNext;	// Next particle in the same cell, indexed by particle (-1 terminates)
 };
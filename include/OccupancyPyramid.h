@@ -0,0 +1,78 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+#include "Parallel.h"	// Multi-threaded build
+
+#define PYRAMID_LEVELS		(5)		// Box sizes 4, 8, 16, 32 and 64
+#define PYRAMID_FINE_SKIP	(1)		// Level of the 8^3 boxes skipped by nextOccupied()
+#define PYRAMID_COARSE_SKIP	(4)		// Level of the 64^3 boxes skipped by nextOccupied()
+
+// Counts of the solid cubes per box at several box sizes, kept up to date as cubes are removed or inserted.
+// Grid scans use it to skip the empty boxes, and the number of boxes at each size holding solid (or solid/void
+// boundary) gives the box-counting dimensions of the solid (and of its surface) without scanning the grid.
+class OccupancyPyramid
+{
+public:
+	OccupancyPyramid() { clear(); }
+
+	// Counts the solid of the grid. solid is the bit-packed solid (x fastest, bit offset&63 of word offset/64).
+	// The caller calls removeCube()/insertCube() once per change of a cell.
+	void build(int xdim, int ydim, int zdim, unsigned int nThreads, const uint64_t* solid);
+	void clear();
+	bool active() { return(m_active); }
+
+	void removeCube(uint64_t offset) { change(offset, -1); }	// The cell was solid
+	void insertCube(uint64_t offset) { change(offset, 1); }		// The cell was void
+
+	// Returns the first offset at or after offset that isn't inside an empty 64^3 or 8^3 box (the grid size if none).
+	// end receives the end of the cells to check one by one (the end of the 8^3 box along the row).
+	uint64_t nextOccupied(uint64_t offset, uint64_t& end);
+
+	// Box counting
+	int boxSize(int level) { return(4 << level); }
+	uint64_t occupiedBoxes(int level) { return(m_occupied[level]); }	// Boxes holding solid
+	uint64_t surfaceBoxes(int level) { return(m_surface[level]); }		// Boxes holding solid and void (or solid on the grid boundary)
+	double massDimension();		// Least squares slope of log(boxes) against log(1 / box size)
+	double surfaceDimension();
+
+private:
+	void fillLevels(unsigned int nThreads, const uint64_t* solid);
+	void change(uint64_t offset, int delta);
+	bool isSurface(int level, int bx, int by, int bz, uint32_t count);
+	double dimension(const uint64_t* boxes);
+
+	bool		m_active;
+	int			m_dims[3];
+	uint64_t	m_rowSize, m_layerSize;
+
+	std::vector<uint32_t>	m_counts[PYRAMID_LEVELS];	// Solid cubes per box (x fastest)
+	int			m_boxDims[PYRAMID_LEVELS][3];		// Boxes along x, y and z
+	uint64_t	m_occupied[PYRAMID_LEVELS];
+	uint64_t	m_surface[PYRAMID_LEVELS];
+};
+
@@ -0,0 +1,78 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+// Minimal fork/join helpers used by the multi-threaded grid passes.
+// Work is split into contiguous chunks, one per thread, and the caller blocks until all chunks complete.
+
+// Returns the number of worker threads to use (0 = all available cores)
+inline unsigned int getThreadCount(unsigned long requested = 0)
+{
+	if (requested)
+		return((unsigned int)requested);
+	unsigned int nThreads = std::thread::hardware_concurrency();
+	return(nThreads ? nThreads : 1);
+}
+
+// Splits [0, count) into at most nThreads contiguous chunks and calls
+// func(begin, end, threadIndex) for each chunk on its own thread.
+// Small workloads (or a single thread) are run inline on the calling thread.
+template <typename Func>
+void parallelFor(int64_t count, unsigned int nThreads, Func func)
+{
+	if (count <= 0)
+		return;
+	if (nThreads < 1)
+		nThreads = 1;
+	if ((int64_t)nThreads > count)
+		nThreads = (unsigned int)count;
+
+	if (nThreads == 1)
+	{
+		func((int64_t)0, count, 0U);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(nThreads - 1);
+	int64_t chunk = count / nThreads;
+	int64_t extra = count % nThreads;
+	int64_t begin = 0;
+	for (unsigned int t = 0; t < nThreads; t++)
+	{
+		int64_t end = begin + chunk + (((int64_t)t < extra) ? 1 : 0);
+		if (t == nThreads - 1)
+			func(begin, end, t);	// The calling thread takes the last chunk
+		else
+			workers.push_back(std::thread(func, begin, end, t));
+		begin = end;
+	}
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
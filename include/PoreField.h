@@ -0,0 +1,44 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+// Spatially correlated random fields used to generate porosity.
+// White noise is smoothed with separable filters (one 1D pass per axis) so that
+// thresholding the field yields pores with a controllable correlation length.
+// The field is stored x fastest, then y, then z (the same order as the cube grid).
+
+#define FIELD_FILTER_BOX		(0)	// Uniform window of width cubes
+#define FIELD_FILTER_GAUSSIAN	(1)	// Gaussian with a standard deviation of width/2 cubes
+
+// Fill field with uniform [0,1) noise.
+// Each row has its own generator seeded from seed and the row index so the noise doesn't depend on the thread count.
+void generateNoiseField(std::vector<float>& field, int xdim, int ydim, int zdim, uint64_t seed, unsigned int nThreads);
+
+// Smooth field along x, y and z with the selected filter.
+// Windows are truncated at the grid boundary and renormalised. Widths of 1 or less leave the field unchanged.
+void smoothField(std::vector<float>& field, int xdim, int ydim, int zdim, int filter, double width, unsigned int nThreads);
@@ -0,0 +1,85 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+// Disjoint set forest over the elements 0..n-1 (union by size with path halving).
+// Used where connectivity only ever grows, e.g. replaying cube removals backwards as insertions.
+class UnionFind
+{
+public:
+	UnionFind(size_t n = 0) { reset(n); }
+
+	// n singleton sets
+	void reset(size_t n)
+	{
+		m_parent.resize(n);
+		m_size.assign(n, 1);
+		for (size_t i = 0; i < n; i++)
+			m_parent[i] = (uint32_t)i;
+	}
+
+	// Adds a singleton set and returns its element
+	uint32_t add()
+	{
+		m_parent.push_back((uint32_t)m_parent.size());
+		m_size.push_back(1);
+		return((uint32_t)m_parent.size() - 1);
+	}
+
+	uint32_t find(uint32_t x)
+	{
+		while (m_parent[x] != x)
+		{
+			m_parent[x] = m_parent[m_parent[x]];
+			x = m_parent[x];
+		}
+		return(x);
+	}
+
+	// Merges the sets of a and b. Returns the root of the merged set.
+	uint32_t unite(uint32_t a, uint32_t b)
+	{
+		a = find(a);
+		b = find(b);
+		if (a == b)
+			return(a);
+		if (m_size[a] < m_size[b])
+			std::swap(a, b);
+		m_parent[b] = a;
+		m_size[a] += m_size[b];
+		return(a);
+	}
+
+	// Element count of the set with the given root
+	uint64_t size(uint32_t root) { return(m_size[root]); }
+	size_t elements() { return(m_parent.size()); }
+
+private:
+	std::vector<uint32_t>	m_parent;
+	std::vector<uint64_t>	m_size;
+};
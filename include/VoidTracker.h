@@ -0,0 +1,170 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+
+#include "robin_hood.h"	// Fast and memory efficient hash table
+
+// Tracks the connectivity of the void (removed cubes and everything outside the object) with an insertion only union-find.
+// Removing cubes only ever adds void so the void connected to the exterior and the enclosed cavities
+// (pores not yet reached by the consumption) are known after every removal without rescanning the grid.
+// Surface is counted as solid faces touching void (faces on the grid boundary touch the exterior).
+// Uses 4 bytes per grid cell.
+class VoidTracker
+{
+public:
+	VoidTracker() { clear(); }
+
+	// Labels the void of the grid. isSolid(offset) returns true for cubes present.
+	template <typename IsSolid>
+	void build(int xdim, int ydim, int zdim, IsSolid isSolid);
+	void clear();
+	bool active() { return(m_active); }
+	static uint64_t maxGridSize() { return(SOLID - 1); }	// Node ids are 32 bit (the exterior node comes after the cells, SOLID after it)
+
+	// Turns a solid cube into void. Returns true if the removal opened an enclosed cavity to the exterior.
+	bool removeCube(uint64_t offset);
+	bool isVoid(uint64_t offset) { return(m_parent[offset] != SOLID); }
+
+	uint64_t exteriorVolume() { return(m_sets[find(m_exterior)].volume - 1); }	// (The exterior node isn't a cube)
+	uint64_t enclosedVolume() { return(m_voidVolume - exteriorVolume()); }
+	uint64_t exteriorSurface() { return(m_sets[find(m_exterior)].surface); }
+	uint64_t enclosedSurface() { return(m_surface - exteriorSurface()); }
+	uint64_t totalSurface() { return(m_surface); }
+	uint64_t cavities() { return(m_sets.size() - 1); }
+	uint64_t breaches() { return(m_breaches); }
+
+private:
+	enum { SOLID = 0xFFFFFFFF };
+
+	struct VoidSet
+	{
+		uint64_t volume;	// Void cubes in the set
+		uint64_t surface;	// Solid faces touching the set
+	};
+
+	uint32_t find(uint32_t x)
+	{
+		while (m_parent[x] != x)
+		{
+			m_parent[x] = m_parent[m_parent[x]];
+			x = m_parent[x];
+		}
+		return(x);
+	}
+	uint32_t unite(uint32_t a, uint32_t b);
+
+	bool		m_active;
+	int			m_dims[3];
+	uint64_t	m_rowSize, m_layerSize;
+	uint32_t	m_exterior;			// Node standing for everything outside the grid
+	std::vector<uint32_t> m_parent;	// Union-find parent of each void cube (SOLID for cubes present)
+	robin_hood::unordered_flat_map<uint32_t, VoidSet> m_sets;	// Set statistics by root
+	uint64_t	m_voidVolume;		// Void cubes inside the grid
+	uint64_t	m_surface;			// All solid faces touching void
+	uint64_t	m_breaches;			// Cavities opened to the exterior since the build
+};
+
+template <typename IsSolid>
+void VoidTracker::build(int xdim, int ydim, int zdim, IsSolid isSolid)
+{
+	m_dims[0] = xdim;
+	m_dims[1] = ydim;
+	m_dims[2] = zdim;
+	m_rowSize = xdim;
+	m_layerSize = m_rowSize * ydim;
+	uint64_t gridSize = m_layerSize * zdim;
+	m_exterior = (uint32_t)gridSize;
+	m_parent.assign(gridSize + 1, SOLID);
+	m_parent[m_exterior] = m_exterior;
+	m_sets.clear();
+	m_sets[m_exterior] = { 1, 0 };
+	m_voidVolume = 0;
+	m_surface = 0;
+	m_breaches = 0;
+
+	// Join each void cube to the void behind it (the rest of its neighbors are joined when they're reached)
+	uint64_t offset = 0;
+	for (int z = 0; z < zdim; z++)
+	{
+		for (int y = 0; y < ydim; y++)
+		{
+			for (int x = 0; x < xdim; x++, offset++)
+			{
+				if (isSolid(offset))
+					continue;
+				m_parent[offset] = (uint32_t)offset;
+				m_sets[(uint32_t)offset] = { 1, 0 };
+				++m_voidVolume;
+				if ((x == 0) || (y == 0) || (z == 0) || (x == xdim - 1) || (y == ydim - 1) || (z == zdim - 1))
+					unite((uint32_t)offset, m_exterior);
+				if ((x > 0) && (m_parent[offset - 1] != SOLID))
+					unite((uint32_t)offset, (uint32_t)(offset - 1));
+				if ((y > 0) && (m_parent[offset - m_rowSize] != SOLID))
+					unite((uint32_t)offset, (uint32_t)(offset - m_rowSize));
+				if ((z > 0) && (m_parent[offset - m_layerSize] != SOLID))
+					unite((uint32_t)offset, (uint32_t)(offset - m_layerSize));
+			}
+		}
+	}
+
+	// Assign the faces of the solid cubes to the void they touch
+	offset = 0;
+	for (int z = 0; z < zdim; z++)
+	{
+		for (int y = 0; y < ydim; y++)
+		{
+			for (int x = 0; x < xdim; x++, offset++)
+			{
+				if (m_parent[offset] != SOLID)
+					continue;
+				int pos[3] = { x, y, z };
+				int64_t step[3] = { 1, (int64_t)m_rowSize, (int64_t)m_layerSize };
+				for (int axis = 0; axis < 3; axis++)
+				{
+					for (int dir = -1; dir <= 1; dir += 2)
+					{
+						int p = pos[axis] + dir;
+						uint32_t adjRoot;
+						if ((p < 0) || (p >= m_dims[axis]))
+							adjRoot = find(m_exterior);
+						else
+						{
+							uint64_t adj = offset + dir * step[axis];
+							if (m_parent[adj] == SOLID)
+								continue;
+							adjRoot = find((uint32_t)adj);
+						}
+						++m_sets[adjRoot].surface;
+						++m_surface;
+					}
+				}
+			}
+		}
+	}
+
+	m_active = true;
+}
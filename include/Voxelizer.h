@@ -0,0 +1,137 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#pragma once
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+// Span based voxeliser.
+// Solids are described analytically (or as CSG trees of analytic primitives) in grid coordinates
+// and converted into runs of solid cubes along x, one list of runs per (y,z) row.
+// A cube (x,y,z) is solid when its centre (x+0.5, y+0.5, z+0.5) lies inside the shape.
+
+// A solid run of cubes x0..x1 (inclusive) on the grid row (y,z)
+struct Span
+{
+	int x0, x1;
+	int y, z;
+};
+
+typedef std::vector<Span> SpanList;
+typedef std::vector<std::pair<int, int> > RunList;	// Inclusive x runs of a single row (sorted, non-overlapping)
+
+// Base class of all voxelisable shapes
+class Shape
+{
+public:
+	virtual ~Shape() {}
+
+	// Inclusive cube bounds of the shape (may extend beyond the grid)
+	virtual void getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const = 0;
+	// Append the solid runs of row (y,z) to runs in increasing x order
+	virtual void getRuns(int y, int z, RunList& runs) const = 0;
+};
+
+// Axis aligned box covering cubes (x0,y0,z0) to (x1,y1,z1) inclusive
+class ShapeBox : public Shape
+{
+public:
+	ShapeBox(int x0, int y0, int z0, int x1, int y1, int z1);
+
+	void getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const;
+	void getRuns(int y, int z, RunList& runs) const;
+
+private:
+	int m_x0, m_y0, m_z0;
+	int m_x1, m_y1, m_z1;
+};
+
+// Superellipsoid centred at (cx,cy,cz) with radii (a,b,c).
+//	(|x/a|^(2/e2) + |y/b|^(2/e2))^(e2/e1) + |z/c|^(2/e1) <= 1
+// e1 = e2 = 1 is an ellipsoid, exponents towards 0 are boxier and exponents above 1 are pinched.
+class ShapeSuperellipsoid : public Shape
+{
+public:
+	ShapeSuperellipsoid(double cx, double cy, double cz, double a, double b, double c, double e1 = 1.0, double e2 = 1.0);
+
+	void getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const;
+	void getRuns(int y, int z, RunList& runs) const;
+
+protected:
+	double m_cx, m_cy, m_cz;
+	double m_a, m_b, m_c;
+	double m_e1, m_e2;
+};
+
+// Ellipsoid centred at (cx,cy,cz) with radii (a,b,c)
+class ShapeEllipsoid : public ShapeSuperellipsoid
+{
+public:
+	ShapeEllipsoid(double cx, double cy, double cz, double a, double b, double c);
+
+	void getRuns(int y, int z, RunList& runs) const;
+};
+
+// Elliptic cylinder centred at (cx,cy,cz) with its axis along x (0), y (1) or z (2).
+// ra and rb are the cross section radii of the two remaining axes (in x,y,z order), halfLength is along the axis.
+class ShapeCylinder : public Shape
+{
+public:
+	ShapeCylinder(double cx, double cy, double cz, double ra, double rb, double halfLength, int axis = 2);
+
+	void getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const;
+	void getRuns(int y, int z, RunList& runs) const;
+
+private:
+	double m_cx, m_cy, m_cz;
+	double m_ra, m_rb;
+	double m_halfLength;
+	int m_axis;
+};
+
+// Constructive solid geometry node. Owns (and deletes) both operands.
+class ShapeCSG : public Shape
+{
+public:
+	enum Operation { UNION = 0, DIFFERENCE, INTERSECTION };
+
+	ShapeCSG(Operation op, Shape* a, Shape* b);
+	~ShapeCSG();
+
+	void getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const;
+	void getRuns(int y, int z, RunList& runs) const;
+
+private:
+	Operation m_op;
+	Shape* m_a;
+	Shape* m_b;
+};
+
+// Converts a shape into spans clipped to the xdim*ydim*zdim grid.
+// Rows are generated concurrently by nThreads threads; spans are returned in z, y, x order.
+void voxelize(const Shape& shape, int xdim, int ydim, int zdim, unsigned int nThreads, SpanList& spans);
+
+// Returns the number of cubes covered by the spans
+uint64_t spanVolume(const SpanList& spans);
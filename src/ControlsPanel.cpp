@@ -1848,15 +1848,22 @@ void ControlsPanel::run(bool is_prerun)
 #ifdef WANT_FRAGMENTATION
 		if (m_params.enableFrag)	// If enabled do fragment detection
 		{
-			fragments = m_grid->detectFragments();
-
-			if (m_params.outputSaveFrags)
-			{	sprintf(filename, "%s\\%sFrags%dx%dx%d_%d.txt", outputDir.c_str(), m_params.cuboid ? "Cuboid" : "Ellipsoid", m_params.xdim, m_params.ydim, m_params.zdim, (int)(Threshhold*100+.5));
-				m_grid->outputFragments(filename);
+			sprintf(filename, "%s\\%sFrags%dx%dx%d_%d.txt", outputDir.c_str(), m_params.cuboid ? "Cuboid" : "Ellipsoid", m_params.xdim, m_params.ydim, m_params.zdim, (int)(Threshhold*100+.5));
+			if (m_grid->usePipelinedFragments())
+			{	// Analysed while consume continues (the count shown is from the latest finished snapshot)
+				m_grid->queueFragments(m_params.outputSaveFrags ? filename : NULL);
+				fragments = m_grid->pipelinedFragments();
 			}
+			else
+			{
+				fragments = m_grid->detectFragments();
+
+				if (m_params.outputSaveFrags)
+					m_grid->outputFragments(filename);
 
-			if (m_params.discardFrags)	// Remove them from the consuming process
-				m_grid->discardFragments();
+				if (m_params.discardFrags)	// Remove them from the consuming process
+					m_grid->discardFragments();
+			}
 		}
 #endif// #ifdef WANT_FRAGMENTATION
 
@@ -1907,6 +1914,9 @@ void ControlsPanel::run(bool is_prerun)
 			m_paused = true;	// Keep this loop from doing any work
 		}
 	}
+#ifdef WANT_FRAGMENTATION
+	m_grid->finishFragments();	// Wait for the last snapshots
+#endif// #ifdef WANT_FRAGMENTATION
 		// Stop timing now
 	std::chrono::duration<double> duration = std::chrono::system_clock::now() - before;
 	message = format("Consuming Elapsed Time: %.3lf(s)\n", duration.count());
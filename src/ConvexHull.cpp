@@ -0,0 +1,349 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include "ConvexHull.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <math.h>
+#include "robin_hood.h"	// Fast and memory efficient hash table
+
+void ConvexHull::clear()
+{
+	m_points.clear();
+	m_faces.clear();
+}
+
+int ConvexHull::addFace(int a, int b, int c)
+{
+	m_faces.push_back(Face());
+	Face& face = m_faces.back();
+	face.v[0] = a;
+	face.v[1] = b;
+	face.v[2] = c;
+	face.adj[0] = face.adj[1] = face.adj[2] = -1;
+	const HullPoint& pa = m_points[a];
+	const HullPoint& pb = m_points[b];
+	const HullPoint& pc = m_points[c];
+	int64_t u[3] = { pb.x - pa.x, pb.y - pa.y, pb.z - pa.z };
+	int64_t w[3] = { pc.x - pa.x, pc.y - pa.y, pc.z - pa.z };
+	face.normal[0] = u[1] * w[2] - u[2] * w[1];
+	face.normal[1] = u[2] * w[0] - u[0] * w[2];
+	face.normal[2] = u[0] * w[1] - u[1] * w[0];
+	face.offset = face.normal[0] * pa.x + face.normal[1] * pa.y + face.normal[2] * pa.z;
+	face.alive = true;
+	return((int)m_faces.size() - 1);
+}
+
+void ConvexHull::assign(std::vector<int>& points, const std::vector<int>& faces)
+{
+	std::vector<int>::iterator it = points.begin();
+	while (it != points.end())
+	{
+		int point = *it++;
+		for (size_t i = 0; i < faces.size(); i++)
+		{
+			if (height(m_faces[faces[i]], point) > 0)
+			{
+				m_faces[faces[i]].outside.push_back(point);
+				break;
+			}
+		}
+	}
+	points.clear();
+}
+
+bool ConvexHull::build(const std::vector<HullPoint>& points)
+{
+	clear();
+	m_points = points;
+	std::sort(m_points.begin(), m_points.end());
+	m_points.erase(std::unique(m_points.begin(), m_points.end()), m_points.end());
+	int nPoints = (int)m_points.size();
+	if (nPoints < 4)
+		return(false);
+
+	// Initial tetrahedron: the first and last points, the point farthest from their line and the point farthest from that plane
+	int a = 0;
+	int b = nPoints - 1;
+	int c = -1;
+	int64_t best = 0;
+	const HullPoint& pa = m_points[a];
+	int64_t ab[3] = { m_points[b].x - pa.x, m_points[b].y - pa.y, m_points[b].z - pa.z };
+	for (int i = 0; i < nPoints; i++)
+	{
+		int64_t ai[3] = { m_points[i].x - pa.x, m_points[i].y - pa.y, m_points[i].z - pa.z };
+		int64_t cross[3] = { ab[1] * ai[2] - ab[2] * ai[1], ab[2] * ai[0] - ab[0] * ai[2], ab[0] * ai[1] - ab[1] * ai[0] };
+		int64_t dist = cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2];
+		if (dist > best)
+		{
+			best = dist;
+			c = i;
+		}
+	}
+	if (c < 0)
+		return(false);	// Collinear
+	int f = addFace(a, b, c);
+	int d = -1;
+	best = 0;
+	for (int i = 0; i < nPoints; i++)
+	{
+		int64_t h = height(m_faces[f], i);
+		if (h < 0)
+			h = -h;
+		if (h > best)
+		{
+			best = h;
+			d = i;
+		}
+	}
+	if (d < 0)
+	{
+		clear();
+		return(false);	// Coplanar
+	}
+	if (height(m_faces[f], d) > 0)
+		std::swap(b, c);	// Orient the base away from d
+	m_faces.clear();
+	int f0 = addFace(a, b, c);	// Edges ab, bc, ca
+	int f1 = addFace(a, d, b);	// Edges ad, db, ba
+	int f2 = addFace(b, d, c);	// Edges bd, dc, cb
+	int f3 = addFace(c, d, a);	// Edges cd, da, ac
+	m_faces[f0].adj[0] = f1; m_faces[f0].adj[1] = f2; m_faces[f0].adj[2] = f3;
+	m_faces[f1].adj[0] = f3; m_faces[f1].adj[1] = f2; m_faces[f1].adj[2] = f0;
+	m_faces[f2].adj[0] = f1; m_faces[f2].adj[1] = f3; m_faces[f2].adj[2] = f0;
+	m_faces[f3].adj[0] = f2; m_faces[f3].adj[1] = f1; m_faces[f3].adj[2] = f0;
+
+	std::vector<int> pending;
+	pending.reserve(nPoints);
+	for (int i = 0; i < nPoints; i++)
+	{
+		if ((i != a) && (i != b) && (i != c) && (i != d))
+			pending.push_back(i);
+	}
+	std::vector<int> initial;
+	initial.push_back(f0);
+	initial.push_back(f1);
+	initial.push_back(f2);
+	initial.push_back(f3);
+	assign(pending, initial);
+
+	// Add the farthest outside point of a face until no face has any
+	std::vector<int> stack;
+	std::vector<int> visible;
+	std::vector<int> newFaces;
+	std::vector<int> visitMark;
+	robin_hood::unordered_flat_map<int, int> byFirst;	// New face by its horizon edge's first vertex
+	int visit = 0;
+	for (size_t current = 0; current < m_faces.size(); current++)
+	{
+		if (!m_faces[current].alive || m_faces[current].outside.empty())
+			continue;
+
+		Face& face = m_faces[current];
+		int apex = face.outside[0];
+		int64_t apexHeight = height(face, apex);
+		for (size_t i = 1; i < face.outside.size(); i++)
+		{
+			int64_t h = height(face, face.outside[i]);
+			if (h > apexHeight)
+			{
+				apexHeight = h;
+				apex = face.outside[i];
+			}
+		}
+
+		// Faces seen from the apex (connected) and the horizon around them
+		++visit;
+		visitMark.resize(m_faces.size(), 0);
+		visible.clear();
+		stack.clear();
+		stack.push_back((int)current);
+		visitMark[current] = visit;
+		std::vector<std::pair<int, int>> horizon;	// (visible face, edge)
+		while (!stack.empty())
+		{
+			int fi = stack.back();
+			stack.pop_back();
+			visible.push_back(fi);
+			for (int e = 0; e < 3; e++)
+			{
+				int nf = m_faces[fi].adj[e];
+				if (visitMark[nf] == visit)
+					continue;
+				if (height(m_faces[nf], apex) > 0)
+				{
+					visitMark[nf] = visit;
+					stack.push_back(nf);
+				}
+				else
+					horizon.push_back(std::make_pair(fi, e));
+			}
+		}
+
+		// Cone of new faces from the horizon to the apex
+		newFaces.clear();
+		byFirst.clear();
+		for (size_t h = 0; h < horizon.size(); h++)
+		{
+			int fi = horizon[h].first;
+			int e = horizon[h].second;
+			int v0 = m_faces[fi].v[e];
+			int v1 = m_faces[fi].v[(e + 1) % 3];
+			int other = m_faces[fi].adj[e];
+			int nf = addFace(v0, v1, apex);
+			m_faces[nf].adj[0] = other;
+			Face& otherFace = m_faces[other];
+			for (int oe = 0; oe < 3; oe++)
+			{
+				if (otherFace.adj[oe] == fi)
+				{
+					otherFace.adj[oe] = nf;
+					break;
+				}
+			}
+			newFaces.push_back(nf);
+			byFirst[v0] = nf;
+		}
+		for (size_t i = 0; i < newFaces.size(); i++)
+		{
+			Face& nface = m_faces[newFaces[i]];
+			nface.adj[1] = byFirst[nface.v[1]];		// Edge v1 -> apex is shared with the face starting at v1
+			m_faces[nface.adj[1]].adj[2] = newFaces[i];	// whose edge apex -> v1 it is
+		}
+
+		// Retire the visible faces and hand their points to the new faces
+		for (size_t i = 0; i < visible.size(); i++)
+		{
+			Face& old = m_faces[visible[i]];
+			old.alive = false;
+			std::vector<int> orphans;
+			orphans.swap(old.outside);
+			orphans.erase(std::remove(orphans.begin(), orphans.end(), apex), orphans.end());
+			assign(orphans, newFaces);
+		}
+	}
+
+	return(true);
+}
+
+void ConvexHull::vertices(std::vector<HullPoint>& points)
+{
+	std::vector<int> used;
+	for (size_t i = 0; i < m_faces.size(); i++)
+	{
+		if (!m_faces[i].alive)
+			continue;
+		for (int v = 0; v < 3; v++)
+			used.push_back(m_faces[i].v[v]);
+	}
+	std::sort(used.begin(), used.end());
+	used.erase(std::unique(used.begin(), used.end()), used.end());
+	points.clear();
+	for (size_t i = 0; i < used.size(); i++)
+		points.push_back(m_points[used[i]]);
+}
+
+double ConvexHull::volume()
+{
+	// Sum of the tetrahedra from the origin to each face (6 x volume, exact)
+	int64_t volume6 = 0;
+	for (size_t i = 0; i < m_faces.size(); i++)
+	{
+		const Face& face = m_faces[i];
+		if (!face.alive)
+			continue;
+		const HullPoint& p = m_points[face.v[0]];
+		volume6 += face.normal[0] * p.x + face.normal[1] * p.y + face.normal[2] * p.z;
+	}
+	return(volume6 / 6.0);
+}
+
+double ConvexHull::area()
+{
+	double area = 0.0;
+	for (size_t i = 0; i < m_faces.size(); i++)
+	{
+		const Face& face = m_faces[i];
+		if (!face.alive)
+			continue;
+		area += sqrt((double)face.normal[0] * face.normal[0] + (double)face.normal[1] * face.normal[1] + (double)face.normal[2] * face.normal[2]);
+	}
+	return(area / 2.0);
+}
+
+void cubeHull(const unsigned long long* keys, size_t count, int keyShift, int xdim, int ydim, unsigned int nThreads, HullStats& stats)
+{
+	stats.volume = stats.area = 0.0;
+
+	std::vector<std::vector<HullPoint>> partHulls(getThreadCount(nThreads));
+	parallelFor((int64_t)count, nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		std::vector<uint64_t> cubes;
+		cubes.reserve(end - begin);
+		for (int64_t i = begin; i < end; i++)
+			cubes.push_back(keys[i] >> keyShift);
+		std::sort(cubes.begin(), cubes.end());
+		cubes.erase(std::unique(cubes.begin(), cubes.end()), cubes.end());
+
+		// Only the ends of each x row can reach the hull: the corners of the cubes between them lie on the
+		// segments joining the low corners of the first cube to the high corners of the last.
+		std::vector<HullPoint> corners;
+		size_t first = 0;
+		while (first < cubes.size())
+		{
+			uint64_t row = cubes[first] / xdim;
+			size_t last = first;
+			while ((last + 1 < cubes.size()) && (cubes[last + 1] / xdim == row))
+				++last;
+			int y = (int)(row % ydim);
+			int z = (int)(row / ydim);
+			int x0 = (int)(cubes[first] % xdim);
+			int x1 = (int)(cubes[last] % xdim) + 1;
+			for (int corner = 0; corner < 4; corner++)
+			{
+				HullPoint low = { x0, y + (corner & 1), z + (corner >> 1) };
+				HullPoint high = { x1, y + (corner & 1), z + (corner >> 1) };
+				corners.push_back(low);
+				corners.push_back(high);
+			}
+			first = last + 1;
+		}
+
+		ConvexHull hull;
+		if (hull.build(corners))
+			hull.vertices(partHulls[thread]);
+		else
+			partHulls[thread].swap(corners);	// Flat (can't happen for whole cubes, kept for safety)
+	});
+
+	std::vector<HullPoint> points;
+	for (size_t t = 0; t < partHulls.size(); t++)
+		points.insert(points.end(), partHulls[t].begin(), partHulls[t].end());
+	ConvexHull hull;
+	if (!hull.build(points))
+		return;
+	stats.volume = hull.volume();
+	stats.area = hull.area();
+}
@@ -0,0 +1,201 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include "DistanceTransform.h"
+#include "Parallel.h"
+#include <algorithm>
+
+// Envelope scratch space of one thread
+struct Envelope
+{
+	std::vector<int>	site;	// Parabola apex positions
+	std::vector<double>	bound;	// Boundaries between the parabolas of the envelope
+
+	void resize(int64_t n) { site.resize(n + 2); bound.resize(n + 3); }
+};
+
+// Squared distances along a line of n cells: d[q] = min over p of (q - p)^2 + f[p].
+// The empty cells at p = -1 and p = n (just outside the grid) are included, so every result is finite.
+static void distance1D(const uint32_t* f, int64_t n, uint32_t* d, Envelope& env)
+{
+	int* site = env.site.data();
+	double* bound = env.bound.data();
+	int k = 0;
+	site[0] = -1;
+	bound[0] = -HUGE_VAL;
+	bound[1] = HUGE_VAL;
+	for (int q = 0; q <= n; q++)
+	{
+		double fq = ((q < n) ? (double)f[q] : 0.0) + (double)q * q;
+		double s;
+		while (true)
+		{
+			int p = site[k];
+			double fp = ((p >= 0) ? (double)f[p] : 0.0) + (double)p * p;
+			s = (fq - fp) / (2.0 * (q - p));
+			if (s > bound[k])
+				break;
+			--k;
+		}
+		++k;
+		site[k] = q;
+		bound[k] = s;
+		bound[k + 1] = HUGE_VAL;
+	}
+
+	k = 0;
+	for (int q = 0; q < n; q++)
+	{
+		while (bound[k + 1] < q)
+			++k;
+		int p = site[k];
+		uint32_t fp = ((p >= 0) && (p < n)) ? f[p] : 0;
+		d[q] = (uint32_t)((q - p) * (q - p)) + fp;
+	}
+}
+
+void depthTransform(const uint64_t* bits, int64_t sx, int64_t sy, int64_t sz, unsigned int nThreads, DepthStats& stats)
+{
+	int64_t sxy = sx * sy;
+	std::vector<uint32_t> dist((size_t)(sxy * sz));
+
+	// x: distance to the nearest empty cell of the row, then y: lower envelope over the rows of the slice
+	parallelFor(sz, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		Envelope env;
+		env.resize(sy);
+		std::vector<uint32_t> f(sy * DEPTH_TILE);
+		std::vector<uint32_t> d(sy);
+		for (int64_t z = begin; z < end; z++)
+		{
+			uint32_t* slice = dist.data() + z * sxy;
+			for (int64_t y = 0; y < sy; y++)
+			{
+				uint32_t* row = slice + y * sx;
+				uint64_t offset = (uint64_t)(z * sxy + y * sx);
+				int64_t last = -1;	// Last empty cell
+				for (int64_t x = 0; x < sx; x++, offset++)
+				{
+					if ((bits[offset >> 6] >> (offset & 63)) & 1)
+						row[x] = (uint32_t)(x - last);
+					else
+					{
+						row[x] = 0;
+						last = x;
+					}
+				}
+				last = sx;
+				for (int64_t x = sx - 1; x >= 0; x--)
+				{
+					if (!row[x])
+						last = x;
+					else
+						row[x] = std::min(row[x], (uint32_t)(last - x));
+					row[x] *= row[x];
+				}
+			}
+
+			for (int64_t x0 = 0; x0 < sx; x0 += DEPTH_TILE)
+			{
+				int64_t width = std::min((int64_t)DEPTH_TILE, sx - x0);
+				for (int64_t y = 0; y < sy; y++)
+					for (int64_t i = 0; i < width; i++)
+						f[i * sy + y] = slice[y * sx + x0 + i];
+				for (int64_t i = 0; i < width; i++)
+				{
+					distance1D(&f[i * sy], sy, d.data(), env);
+					for (int64_t y = 0; y < sy; y++)
+						slice[y * sx + x0 + i] = d[y];
+				}
+			}
+		}
+	});
+
+	// z: lower envelope over the slices. The depths of the solid cubes are counted by squared depth.
+	std::vector<std::vector<uint64_t>> counts(getThreadCount(nThreads));
+	parallelFor(sy, nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		Envelope env;
+		env.resize(sz);
+		std::vector<uint32_t> f(sz * DEPTH_TILE);
+		std::vector<uint32_t> d(sz);
+		std::vector<uint64_t>& count = counts[thread];
+		for (int64_t y = begin; y < end; y++)
+		{
+			for (int64_t x0 = 0; x0 < sx; x0 += DEPTH_TILE)
+			{
+				int64_t width = std::min((int64_t)DEPTH_TILE, sx - x0);
+				for (int64_t z = 0; z < sz; z++)
+				{
+					const uint32_t* cells = dist.data() + z * sxy + y * sx + x0;
+					for (int64_t i = 0; i < width; i++)
+						f[i * sz + z] = cells[i];
+				}
+				for (int64_t i = 0; i < width; i++)
+				{
+					distance1D(&f[i * sz], sz, d.data(), env);
+					uint64_t offset = (uint64_t)(y * sx + x0 + i);
+					for (int64_t z = 0; z < sz; z++, offset += sxy)
+					{
+						if (!((bits[offset >> 6] >> (offset & 63)) & 1))
+							continue;
+						if (d[z] >= count.size())
+							count.resize(d[z] + 1, 0);
+						++count[d[z]];
+					}
+				}
+			}
+		}
+	});
+
+	// Merge the threads and bin by depth
+	stats.solid = 0;
+	stats.maxDepthSq = 0;
+	stats.meanDepth = 0.0;
+	stats.histogram.clear();
+	size_t maxSq = 0;
+	for (size_t t = 0; t < counts.size(); t++)
+		maxSq = std::max(maxSq, counts[t].size());
+	double totalDepth = 0.0;
+	for (size_t depthSq = 0; depthSq < maxSq; depthSq++)
+	{
+		uint64_t n = 0;
+		for (size_t t = 0; t < counts.size(); t++)
+			if (depthSq < counts[t].size())
+				n += counts[t][depthSq];
+		if (!n)
+			continue;
+		double depth = sqrt((double)depthSq);
+		size_t bin = (size_t)depth;
+		if (bin >= stats.histogram.size())
+			stats.histogram.resize(bin + 1, 0);
+		stats.histogram[bin] += n;
+		stats.solid += n;
+		stats.maxDepthSq = depthSq;
+		totalDepth += n * depth;
+	}
+	if (stats.solid)
+		stats.meanDepth = totalDepth / stats.solid;
+}
@@ -0,0 +1,158 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include "EulerTracker.h"
+
+// The tables hold 8 x the values so the shared cells can be split between the corners in whole numbers:
+// a vertex belongs to 1 corner, an edge to 2, a face to 4 and the cube to 8.
+EulerTracker::EulerTracker()
+{
+	// Corner of an added cube. Bits 0-2 = face neighbors (x, y, z), 3-5 = edge neighbors (xy, xz, yz), 6 = vertex neighbor.
+	for (int config = 0; config < 128; config++)
+	{
+		bool bit[7];
+		for (int b = 0; b < 7; b++)
+			bit[b] = ((config >> b) & 1) != 0;
+		int newVertex = (config == 0) ? 1 : 0;
+		int newEdges = (!bit[1] && !bit[2] && !bit[5]) + (!bit[0] && !bit[2] && !bit[4]) + (!bit[0] && !bit[1] && !bit[3]);	// Along x, y and z
+		int newFaces = !bit[0] + !bit[1] + !bit[2];
+		m_cornerTable[config] = 8 * newVertex - 4 * newEdges + 2 * newFaces - 1;
+	}
+
+	// Lattice vertex. Bit (dx + 2 * dy + 4 * dz) is set for each solid cell of the 2x2x2 block around it.
+	for (int config = 0; config < 256; config++)
+	{
+		int vertex = (config != 0) ? 1 : 0;
+		int edges = 0;
+		int faces = 0;
+		int cubes = 0;
+		for (int cell = 0; cell < 8; cell++)
+			cubes += (config >> cell) & 1;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			int step = 1 << axis;
+			for (int side = 0; side < 2; side++)
+			{	// The edge along the axis on this side of the vertex is shared by the 4 cells on that side
+				int mask = 0;
+				for (int cell = 0; cell < 8; cell++)
+				{
+					if (((cell >> axis) & 1) == side)
+						mask |= 1 << cell;
+				}
+				if (config & mask)
+					++edges;
+			}
+			for (int cell = 0; cell < 8; cell++)
+			{	// The faces across the axis are shared by a cell and its neighbor on the other side
+				if ((cell >> axis) & 1)
+					continue;
+				if (config & ((1 << cell) | (1 << (cell + step))))
+					++faces;
+			}
+		}
+		m_vertexTable[config] = 8 * vertex - 4 * edges + 2 * faces - cubes;
+	}
+
+	clear();
+}
+
+void EulerTracker::clear()
+{
+	m_active = false;
+	m_solid = NULL;
+	m_euler = 0;
+}
+
+void EulerTracker::build(int xdim, int ydim, int zdim, const uint64_t* solid)
+{
+	m_dims[0] = xdim;
+	m_dims[1] = ydim;
+	m_dims[2] = zdim;
+	m_rowSize = xdim;
+	m_layerSize = m_rowSize * ydim;
+	m_solid = solid;
+	countSolid();
+
+	m_active = true;
+}
+
+int EulerTracker::cornerChange(uint64_t offset)
+{
+	int x = (int)(offset % m_rowSize);
+	int y = (int)((offset / m_rowSize) % m_dims[1]);
+	int z = (int)(offset / m_layerSize);
+	int change = 0;
+	for (int dz = -1; dz <= 1; dz += 2)
+	{
+		for (int dy = -1; dy <= 1; dy += 2)
+		{
+			for (int dx = -1; dx <= 1; dx += 2)
+			{
+				int config = isSolid(x + dx, y, z) |
+							(isSolid(x, y + dy, z) << 1) |
+							(isSolid(x, y, z + dz) << 2) |
+							(isSolid(x + dx, y + dy, z) << 3) |
+							(isSolid(x + dx, y, z + dz) << 4) |
+							(isSolid(x, y + dy, z + dz) << 5) |
+							(isSolid(x + dx, y + dy, z + dz) << 6);
+				change += m_cornerTable[config];
+			}
+		}
+	}
+	return(change);
+}
+
+void EulerTracker::removeCube(uint64_t offset)
+{
+	m_euler -= cornerChange(offset) / 8;
+}
+
+void EulerTracker::insertCube(uint64_t offset)
+{
+	m_euler += cornerChange(offset) / 8;
+}
+
+// Sums the contribution of every lattice vertex (cells outside the grid are void)
+void EulerTracker::countSolid()
+{
+	int64_t sum = 0;
+	for (int z = 0; z <= m_dims[2]; z++)
+	{
+		for (int y = 0; y <= m_dims[1]; y++)
+		{
+			for (int x = 0; x <= m_dims[0]; x++)
+			{
+				int config = 0;
+				for (int cell = 0; cell < 8; cell++)
+				{
+					if (isSolid(x - 1 + (cell & 1), y - 1 + ((cell >> 1) & 1), z - 1 + ((cell >> 2) & 1)))
+						config |= 1 << cell;
+				}
+				sum += m_vertexTable[config];
+			}
+		}
+	}
+	m_euler = sum / 8;
+}
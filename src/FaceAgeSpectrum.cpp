@@ -0,0 +1,64 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include "FaceAgeSpectrum.h"
+#include <stdio.h>
+
+void FaceAgeSpectrum::clear()
+{
+	m_active = false;
+	m_retired.clear();
+}
+
+void FaceAgeSpectrum::surface(const std::vector<uint64_t>& exposedSince, uint64_t now, std::vector<uint64_t>& hist)
+{
+	hist.clear();
+	std::vector<uint64_t>::const_iterator it = exposedSince.begin();
+	while (it != exposedSince.end())
+	{
+		int bin = ageBin(now - *it++);
+		if (bin >= (int)hist.size())
+			hist.resize(bin + 1, 0);
+		++hist[bin];
+	}
+}
+
+bool FaceAgeSpectrum::output(const char* filename, const std::vector<uint64_t>& current)
+{
+	FILE* fp = fopen(filename, "w+");
+	if (fp == NULL)
+		return(false);
+
+	size_t bins = (current.size() > m_retired.size()) ? current.size() : m_retired.size();
+	for (size_t bin = 0; bin < bins; bin++)
+	{
+		uint64_t first = bin ? (1ULL << (bin - 1)) : 0;
+		uint64_t last = bin ? (1ULL << bin) - 1 : 0;
+		fprintf(fp, "%llu,%llu,%llu,%llu\n", (unsigned long long)first, (unsigned long long)last, (bin < current.size()) ? current[bin] : 0ULL, (bin < m_retired.size()) ? m_retired[bin] : 0ULL);
+	}
+
+	fclose(fp);
+	return(true);
+}
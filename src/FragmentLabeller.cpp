@@ -0,0 +1,323 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#include "cc3d.hpp"		// Connected components labelling library
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "FragmentLabeller.h"
+#include "Parallel.h"
+#include "UnionFind.h"
+
+// Lock free union-find used to join slab labels from several threads.
+// A root is always linked under the smaller root so every set ends up rooted at its smallest label.
+class ConcurrentUnionFind
+{
+public:
+	ConcurrentUnionFind(size_t n) : m_parent(n)
+	{
+		for (size_t i = 0; i < n; i++)
+			m_parent[i].store((uint32_t)i, std::memory_order_relaxed);
+	}
+
+	uint32_t find(uint32_t x)
+	{
+		uint32_t parent = m_parent[x].load(std::memory_order_relaxed);
+		while (parent != x)
+		{
+			uint32_t grandParent = m_parent[parent].load(std::memory_order_relaxed);
+			if (grandParent != parent)	// Path halving (losing the race only skips the shortcut)
+				m_parent[x].compare_exchange_weak(parent, grandParent, std::memory_order_relaxed);
+			x = grandParent;
+			parent = m_parent[x].load(std::memory_order_relaxed);
+		}
+		return(x);
+	}
+
+	void unite(uint32_t a, uint32_t b)
+	{
+		while (true)
+		{
+			a = find(a);
+			b = find(b);
+			if (a == b)
+				return;
+			if (a < b)
+				std::swap(a, b);
+			uint32_t expected = a;
+			if (m_parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+				return;
+			// Another thread linked a first; retry from the new roots
+		}
+	}
+
+private:
+	std::vector<std::atomic<uint32_t>>	m_parent;
+};
+
+size_t labelOccupancy(const uint64_t* bits, int64_t sx, int64_t sy, int64_t sz, size_t maxLabels, int64_t connectivity, unsigned int nThreads, LabelBuffers& buffers, std::vector<uint32_t>& labels)
+{
+	const int64_t sxy = sx * sy;
+	const int64_t nWords = (sxy * sz + 63) / 64;
+
+	// Occupied cells before each word give every occupied cell its slot in labels
+	std::vector<uint32_t>& wordRank = buffers.wordRank;
+	wordRank.resize(nWords + 1);
+	wordRank[0] = 0;
+	for (int64_t word = 0; word < nWords; word++)
+		wordRank[word + 1] = wordRank[word] + bitCount(bits[word]);
+	labels.resize(wordRank[nWords]);
+	if (labels.empty())
+		return(0);
+
+	int64_t nSlabs = std::max((sz + LABEL_SLAB_LAYERS - 1) / LABEL_SLAB_LAYERS, std::min((int64_t)nThreads, sz / LABEL_SLAB_MIN));
+	std::vector<int64_t> slabStart(nSlabs + 1);
+	std::vector<uint32_t> slabRank(nSlabs + 1);
+	int64_t maxVoxels = 0;
+	for (int64_t slab = 0; slab <= nSlabs; slab++)
+	{
+		slabStart[slab] = sz * slab / nSlabs;
+		slabRank[slab] = (slab < nSlabs) ? buffers.rank(bits, slabStart[slab] * sxy) : (uint32_t)labels.size();
+		if (slab)
+			maxVoxels = std::max(maxVoxels, (slabStart[slab] - slabStart[slab - 1]) * sxy);
+	}
+
+	unsigned int nWorkers = (unsigned int)std::min((int64_t)nThreads, nSlabs);
+	buffers.slabIn.resize(nWorkers);
+	buffers.slabOut.resize(nWorkers);
+	buffers.layers.resize(2 * nSlabs * sxy);
+
+	// Unpack and label each slab on its own, keeping its boundary layers and the labels of its occupied cells
+	std::vector<size_t> slabLabels(nSlabs, 0);
+	parallelFor(nSlabs, nWorkers, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		std::vector<uint8_t>& in = buffers.slabIn[thread];
+		std::vector<uint32_t>& out = buffers.slabOut[thread];
+		if ((int64_t)in.size() < maxVoxels)
+		{
+			in.resize(maxVoxels);
+			out.resize(maxVoxels);
+		}
+		for (int64_t slab = begin; slab < end; slab++)
+		{
+			uint64_t first = slabStart[slab] * sxy;
+			int64_t voxels = (slabStart[slab + 1] - slabStart[slab]) * sxy;
+			for (int64_t loc = 0; loc < voxels; loc++)
+			{
+				uint64_t offset = first + loc;
+				in[loc] = (uint8_t)((bits[offset >> 6] >> (offset & 63)) & 1);
+			}
+			std::fill(out.begin(), out.begin() + voxels, 0);
+			cc3d::connected_components3d<uint8_t>(in.data(), sx, sy, slabStart[slab + 1] - slabStart[slab], maxLabels, connectivity, out.data(), slabLabels[slab]);
+
+			std::copy(out.begin(), out.begin() + sxy, buffers.layers.begin() + 2 * slab * sxy);
+			std::copy(out.begin() + voxels - sxy, out.begin() + voxels, buffers.layers.begin() + (2 * slab + 1) * sxy);
+			uint32_t cell = slabRank[slab];
+			for (int64_t loc = 0; loc < voxels; loc++)
+			{
+				if (in[loc])
+					labels[cell++] = out[loc];
+			}
+		}
+	});
+	if (nSlabs == 1)
+		return(slabLabels[0]);
+
+	// Slab labels are made unique by offsetting them with the label count of the slabs below
+	std::vector<uint32_t> base(nSlabs + 1, 0);
+	for (int64_t slab = 0; slab < nSlabs; slab++)
+		base[slab + 1] = base[slab] + (uint32_t)slabLabels[slab];
+	size_t totalLabels = base[nSlabs];
+
+	// Join the labels touching across each slab boundary (the first layer of a slab against the last layer of the one below)
+	ConcurrentUnionFind equivalences(totalLabels + 1);
+	parallelFor(nSlabs - 1, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t boundary = begin; boundary < end; boundary++)
+		{
+			int64_t slab = boundary + 1;
+			const uint32_t* upper = buffers.layers.data() + 2 * slab * sxy;
+			const uint32_t* lower = upper - sxy;
+			for (int64_t y = 0; y < sy; y++)
+			{
+				for (int64_t x = 0; x < sx; x++)
+				{
+					uint32_t label = upper[y * sx + x];
+					if (label == 0)
+						continue;
+					label += base[slab];
+					for (int64_t dy = -1; dy <= 1; dy++)
+					{
+						for (int64_t dx = -1; dx <= 1; dx++)
+						{
+							if ((connectivity == 6) && (dx || dy))
+								continue;	// Faces only
+							if ((connectivity == 18) && dx && dy)
+								continue;	// No vertices
+							int64_t nx = x + dx;
+							int64_t ny = y + dy;
+							if ((nx < 0) || (ny < 0) || (nx >= sx) || (ny >= sy))
+								continue;
+							uint32_t adjLabel = lower[ny * sx + nx];
+							if (adjLabel)
+								equivalences.unite(label, adjLabel + base[slab - 1]);
+						}
+					}
+				}
+			}
+		}
+	});
+
+	// Number the joined labels in order of first appearance (every set is rooted at its first label)
+	std::vector<uint32_t> renumber(totalLabels + 1, 0);
+	uint32_t nextLabel = 1;
+	for (uint32_t label = 1; label <= totalLabels; label++)
+	{
+		uint32_t root = equivalences.find(label);
+		renumber[label] = (root == label) ? nextLabel++ : renumber[root];
+	}
+
+	parallelFor(nSlabs, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t slab = begin; slab < end; slab++)
+		{
+			for (uint32_t cell = slabRank[slab]; cell < slabRank[slab + 1]; cell++)
+				labels[cell] = renumber[labels[cell] + base[slab]];
+		}
+	});
+
+	return(nextLabel - 1);
+}
+
+size_t labelRuns(const uint64_t* offsets, size_t nCells, int64_t sx, int64_t sy, int64_t sz, int64_t connectivity, unsigned int nThreads, uint32_t* labels)
+{
+	if (nCells == 0)
+		return(0);
+
+	// Bucket the cells by row (counting sort on y,z) then order each row by x
+	int64_t nRows = sy * sz;
+	std::vector<uint32_t> rowStart(nRows + 1, 0);
+	for (size_t i = 0; i < nCells; i++)
+		++rowStart[offsets[i] / sx + 1];
+	for (int64_t row = 0; row < nRows; row++)
+		rowStart[row + 1] += rowStart[row];
+	std::vector<uint32_t> cellX(nCells);
+	{
+		std::vector<uint32_t> fill(rowStart.begin(), rowStart.end() - 1);
+		for (size_t i = 0; i < nCells; i++)
+			cellX[fill[offsets[i] / sx]++] = (uint32_t)(offsets[i] % sx);
+	}
+	parallelFor(nRows, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t row = begin; row < end; row++)
+			std::sort(cellX.begin() + rowStart[row], cellX.begin() + rowStart[row + 1]);
+	});
+
+	// Collapse each row into runs [x0, x1] (runs are in raster order)
+	std::vector<uint32_t> runX0, runX1;
+	std::vector<uint32_t> rowRuns(nRows + 1, 0);
+	for (int64_t row = 0; row < nRows; row++)
+	{
+		rowRuns[row] = (uint32_t)runX0.size();
+		for (uint32_t i = rowStart[row]; i < rowStart[row + 1]; i++)
+		{
+			if ((i > rowStart[row]) && (cellX[i] == runX1.back() + 1))
+				runX1.back() = cellX[i];
+			else
+			{
+				runX0.push_back(cellX[i]);
+				runX1.push_back(cellX[i]);
+			}
+		}
+	}
+	rowRuns[nRows] = (uint32_t)runX0.size();
+	uint32_t nRuns = (uint32_t)runX0.size();
+
+	// Previous rows each row is joined to: (dy, dz, x reach). x reach 1 lets diagonal neighbors touch.
+	int reach = (connectivity == 6) ? 0 : 1;
+	int diagonals[4][3] = { { -1, 0, reach }, { 0, -1, reach }, { -1, -1, (connectivity == 26) ? 1 : 0 }, { 1, -1, (connectivity == 26) ? 1 : 0 } };
+	int nDiagonals = (connectivity == 6) ? 2 : 4;
+
+	UnionFind runSets(nRuns);
+	for (int64_t z = 0; z < sz; z++)
+	{
+		for (int64_t y = 0; y < sy; y++)
+		{
+			int64_t row = z * sy + y;
+			for (int d = 0; d < nDiagonals; d++)
+			{
+				int64_t ny = y + diagonals[d][0];
+				int64_t nz = z + diagonals[d][1];
+				if ((ny < 0) || (nz < 0) || (ny >= sy))
+					continue;
+				int64_t adjRow = nz * sy + ny;
+				int64_t xReach = diagonals[d][2];
+				// Merge walk of the two sorted run lists
+				uint32_t a = rowRuns[row], b = rowRuns[adjRow];
+				while ((a < rowRuns[row + 1]) && (b < rowRuns[adjRow + 1]))
+				{
+					if (runX1[b] + xReach < runX0[a])
+						++b;
+					else if (runX1[a] + xReach < runX0[b])
+						++a;
+					else
+					{	// Overlap (within reach)
+						runSets.unite(a, b);
+						if (runX1[a] < runX1[b])
+							++a;
+						else
+							++b;
+					}
+				}
+			}
+		}
+	}
+
+	// Number in order of first appearance
+	std::vector<uint32_t> runLabel(nRuns, 0);
+	std::vector<uint32_t> rootLabel(nRuns, 0);
+	uint32_t nextLabel = 1;
+	for (uint32_t run = 0; run < nRuns; run++)
+	{
+		uint32_t root = runSets.find(run);
+		if (rootLabel[root] == 0)
+			rootLabel[root] = nextLabel++;
+		runLabel[run] = rootLabel[root];
+	}
+
+	// Label of each cell from its run
+	parallelFor((int64_t)nCells, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t i = begin; i < end; i++)
+		{
+			int64_t row = offsets[i] / sx;
+			uint32_t x = (uint32_t)(offsets[i] % sx);
+			std::vector<uint32_t>::const_iterator it = std::upper_bound(runX0.begin() + rowRuns[row], runX0.begin() + rowRuns[row + 1], x);
+			labels[i] = runLabel[(it - runX0.begin()) - 1];
+		}
+	});
+
+	return(nextLabel - 1);
+}
@@ -0,0 +1,150 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#include "FragmentPipeline.h"
+#include "FragmentLabeller.h"
+#include "Parallel.h"
+
+#ifdef WANT_FRAGMENTATION
+
+FragmentPipeline::FragmentPipeline(int64_t xdim, int64_t ydim, int64_t zdim, int64_t connectivity, unsigned int nThreads)
+{
+	m_xdim			= xdim;
+	m_ydim			= ydim;
+	m_zdim			= zdim;
+	m_connectivity	= connectivity;
+	m_nThreads		= nThreads;
+	m_stop			= false;
+	m_fragments		= 0;
+
+	m_thread = std::thread(&FragmentPipeline::worker, this);
+}
+
+FragmentPipeline::~FragmentPipeline()
+{
+	finish();
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+void FragmentPipeline::submit(std::vector<uint64_t>& cells, const char* filename)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_done.wait(lock, [&] { return(m_jobs.size() < PIPELINE_DEPTH); });	// Keeps the snapshot memory bounded
+
+	m_jobs.push_back(Job());
+	m_jobs.back().cells.swap(cells);
+	if (filename)
+		m_jobs.back().filename = filename;
+	m_wake.notify_one();
+}
+
+void FragmentPipeline::finish()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_done.wait(lock, [&] { return(m_jobs.empty()); });
+}
+
+int FragmentPipeline::fragments()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return(m_fragments);
+}
+
+void FragmentPipeline::worker()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (true)
+	{
+		m_wake.wait(lock, [&] { return(m_stop || !m_jobs.empty()); });
+		if (m_jobs.empty())
+			return;		// Stopped
+
+		Job& job = m_jobs.front();	// Stays in place while jobs are added behind it
+		lock.unlock();
+		analyse(job);
+		lock.lock();
+
+		m_fragments = (int)m_stats.labels();
+		m_jobs.pop_front();
+		m_done.notify_all();
+	}
+}
+
+// Same labelling and statistics as MultiCube::assignFragmentIds(), on the snapshot instead of the live grid
+void FragmentPipeline::analyse(Job& job)
+{
+	int64_t nCells = (int64_t)job.cells.size();
+	int64_t gridSize = m_xdim * m_ydim * m_zdim;
+	m_offsets.resize(nCells);
+	m_labels.resize(nCells);
+	parallelFor(nCells, m_nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t i = begin; i < end; i++)
+			m_offsets[i] = job.cells[i] >> SNAPSHOT_FACE_BITS;
+	});
+
+	size_t nLabels = 0;
+	if (nCells * RUN_LABEL_DENSITY < gridSize)
+		nLabels = labelRuns(m_offsets.data(), nCells, m_xdim, m_ydim, m_zdim, m_connectivity, m_nThreads, m_labels.data());
+	else
+	{
+		if (m_occupancy.empty())
+			m_occupancy.assign((gridSize + 63) / 64, 0);
+		for (int64_t i = 0; i < nCells; i++)
+			m_occupancy[m_offsets[i] >> 6] |= 1ULL << (m_offsets[i] & 63);
+
+		nLabels = labelOccupancy(m_occupancy.data(), m_xdim, m_ydim, m_zdim, MAXFRAGS, m_connectivity, m_nThreads, m_buffers, m_cellLabels);
+		parallelFor(nCells, m_nThreads, [&](int64_t begin, int64_t end, unsigned int)
+		{
+			for (int64_t i = begin; i < end; i++)
+				m_labels[i] = m_cellLabels[m_buffers.rank(m_occupancy.data(), m_offsets[i])];
+		});
+
+		for (int64_t i = 0; i < nCells; i++)
+			m_occupancy[m_offsets[i] >> 6] = 0;
+	}
+
+	m_stats.reset((uint32_t)nLabels);
+	int64_t layerSize = m_xdim * m_ydim;
+	for (int64_t i = 0; i < nCells; i++)
+	{
+		int64_t offset = (int64_t)m_offsets[i];
+		int z = (int)(offset / layerSize);
+		int y = (int)((offset % layerSize) / m_xdim);
+		int x = (int)(offset % m_xdim);
+		m_stats.add(m_labels[i], x, y, z, (int)(job.cells[i] & ((1 << SNAPSHOT_FACE_BITS) - 1)));
+	}
+
+	if (!job.filename.empty())
+		m_stats.output(job.filename.c_str());
+
+	std::vector<uint64_t>().swap(job.cells);	// Release the snapshot
+}
+
+#endif //#ifdef WANT_FRAGMENTATION
@@ -0,0 +1,119 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#include "FragmentTracker.h"
+
+void FragmentTracker::clear()
+{
+	m_overlap.clear();
+	m_labelTrack.clear();
+	m_tracks.clear();
+	m_splits = 0;
+}
+
+void FragmentTracker::match(const std::vector<uint32_t>& sizes, uint64_t removed)
+{
+	uint32_t nPrev = (uint32_t)m_labelTrack.size();
+	uint32_t nLabels = (uint32_t)sizes.size();
+
+	// The previous label each new label shares the most cubes with, and the new label sharing the most cubes with each previous label.
+	// Ties go to the lower label so the result doesn't depend on the hash order.
+	std::vector<uint32_t> follows(nLabels, NONE);
+	std::vector<uint64_t> followCount(nLabels, 0);
+	std::vector<uint32_t> heir(nPrev, NONE);
+	std::vector<uint64_t> heirCount(nPrev, 0);
+	robin_hood::unordered_flat_map<uint64_t, uint64_t>::iterator it = m_overlap.begin();
+	while (it != m_overlap.end())
+	{
+		uint32_t prevLabel = (uint32_t)(it->first >> 32);
+		uint32_t newLabel = (uint32_t)it->first;
+		uint64_t count = it->second;
+		++it;
+		if ((prevLabel >= nPrev) || (m_labelTrack[prevLabel] == NONE) || (newLabel >= nLabels))
+			continue;	// Not part of a tracked fragment
+		if ((count > followCount[newLabel]) || ((count == followCount[newLabel]) && (prevLabel < follows[newLabel])))
+		{
+			follows[newLabel] = prevLabel;
+			followCount[newLabel] = count;
+		}
+		if ((count > heirCount[prevLabel]) || ((count == heirCount[prevLabel]) && (newLabel < heir[prevLabel])))
+		{
+			heir[prevLabel] = newLabel;
+			heirCount[prevLabel] = count;
+		}
+	}
+	m_overlap.clear();
+
+	std::vector<uint32_t> labelTrack(nLabels, NONE);
+	for (uint32_t label = 1; label < nLabels; label++)
+	{
+		if (sizes[label] == 0)
+			continue;
+		uint32_t prevLabel = follows[label];
+		if ((prevLabel != NONE) && (heir[prevLabel] == label))
+			labelTrack[label] = m_labelTrack[prevLabel];	// Same fragment (possibly smaller)
+		else
+		{	// New fragment: a piece split off a previous fragment, or one seen for the first time
+			Track track;
+			track.parent = (prevLabel != NONE) ? m_labelTrack[prevLabel] : (uint32_t)NONE;
+			track.birth = removed;
+			track.death = NONE;
+			track.birthSize = sizes[label];
+			labelTrack[label] = (uint32_t)m_tracks.size();
+			m_tracks.push_back(track);
+			if (prevLabel != NONE)
+				++m_splits;
+		}
+		m_tracks[labelTrack[label]].size = sizes[label];
+	}
+
+	// Previous fragments nothing follows are gone
+	for (uint32_t prevLabel = 1; prevLabel < nPrev; prevLabel++)
+	{
+		if (m_labelTrack[prevLabel] == NONE)
+			continue;
+		uint32_t label = heir[prevLabel];
+		if ((label == NONE) || (labelTrack[label] != m_labelTrack[prevLabel]))
+			m_tracks[m_labelTrack[prevLabel]].death = removed;
+	}
+
+	m_labelTrack.swap(labelTrack);
+}
+
+bool FragmentTracker::output(const char* filename)
+{
+	FILE* fp = fopen(filename, "w+");
+	if (fp == NULL)
+		return(false);
+
+	for (size_t id = 0; id < m_tracks.size(); id++)
+	{
+		Track& track = m_tracks[id];
+		fprintf(fp, "%zu,%lld,%llu,%lld,%llu,%llu\n", id, (track.parent == NONE) ? -1LL : (long long)track.parent, (unsigned long long)track.birth,
+			(track.death == NONE) ? -1LL : (long long)track.death, (unsigned long long)track.birthSize, (unsigned long long)track.size);
+	}
+
+	fclose(fp);
+	return(true);
+}
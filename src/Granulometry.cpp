@@ -0,0 +1,207 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include "Granulometry.h"
+#include "FragmentLabeller.h"	// bitCount()
+#include "Parallel.h"
+
+// Phase mask with each x row padded to whole words (shifts along x stay in their row)
+struct PhaseMask
+{
+	int64_t		sx, sy, sz;
+	int64_t		rowWords;	// Words per x row
+	uint64_t	tail;		// Bits of the last word of a row inside the grid
+
+	int64_t words() const { return(rowWords * sy * sz); }
+};
+
+double SizeDistribution::meanSize() const
+{
+	if (volume() == 0)
+		return(0.0);
+	double sum = 0.0;
+	for (size_t edge = 1; edge <= opened.size(); edge++)
+		sum += (double)edge * (double)sized(edge);
+	return(sum / (double)volume());
+}
+
+// Word of a row holding bits word * 64 + shift on (cells outside the row are clear)
+static inline uint64_t shiftedWord(const uint64_t* row, int64_t rowWords, int64_t word, int64_t shift)
+{
+	int64_t bit = word * 64 + shift;
+	int64_t first = (bit >= 0) ? (bit / 64) : -((63 - bit) / 64);
+	int rem = (int)(bit - first * 64);
+	uint64_t value = ((first >= 0) && (first < rowWords)) ? (row[first] >> rem) : 0;
+	if (rem && (first + 1 >= 0) && (first + 1 < rowWords))
+		value |= row[first + 1] << (64 - rem);
+	return(value);
+}
+
+// out(i) = in(i + s1) op in(i + s2) along one axis (0 = x, 1 = y, 2 = z), op = AND or OR
+static void combine(const PhaseMask& mask, const uint64_t* in, uint64_t* out, int axis, int64_t s1, int64_t s2, bool isAnd, unsigned int nThreads)
+{
+	int64_t rowWords = mask.rowWords;
+	parallelFor(mask.sy * mask.sz, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t row = begin; row < end; row++)
+		{
+			uint64_t* dst = out + row * rowWords;
+			if (axis == 0)
+			{
+				const uint64_t* src = in + row * rowWords;
+				for (int64_t word = 0; word < rowWords; word++)
+				{
+					uint64_t a = shiftedWord(src, rowWords, word, s1);
+					uint64_t b = shiftedWord(src, rowWords, word, s2);
+					dst[word] = isAnd ? (a & b) : (a | b);
+				}
+				dst[rowWords - 1] &= mask.tail;
+				continue;
+			}
+
+			int64_t pos = (axis == 1) ? (row % mask.sy) : (row / mask.sy);
+			int64_t size = (axis == 1) ? mask.sy : mask.sz;
+			int64_t stride = (axis == 1) ? 1 : mask.sy;	// Rows between neighbours
+			const uint64_t* src1 = ((pos + s1 >= 0) && (pos + s1 < size)) ? in + (row + s1 * stride) * rowWords : NULL;
+			const uint64_t* src2 = ((pos + s2 >= 0) && (pos + s2 < size)) ? in + (row + s2 * stride) * rowWords : NULL;
+			for (int64_t word = 0; word < rowWords; word++)
+			{
+				uint64_t a = src1 ? src1[word] : 0;
+				uint64_t b = src2 ? src2[word] : 0;
+				dst[word] = isAnd ? (a & b) : (a | b);
+			}
+		}
+	});
+}
+
+static uint64_t countMask(const PhaseMask& mask, const uint64_t* bits, unsigned int nThreads)
+{
+	std::vector<uint64_t> counts(getThreadCount(nThreads), 0);
+	parallelFor(mask.words(), nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		uint64_t count = 0;
+		for (int64_t word = begin; word < end; word++)
+			count += bitCount(bits[word]);
+		counts[thread] += count;
+	});
+	uint64_t total = 0;
+	for (size_t i = 0; i < counts.size(); i++)
+		total += counts[i];
+	return(total);
+}
+
+// Dilation by a box of edge L anchored at its far corner: the OR of in over (i - L, i] on each axis.
+// Doubling passes make f(i) = the OR over (i - p, i] for the largest power of two p <= L, then
+// f(i) | f(i - L + p) covers the L cells. (The windows look back so f is 0 wherever it lies outside the grid)
+// in is kept, the result is in a or b (returned).
+static const uint64_t* dilate(const PhaseMask& mask, const uint64_t* in, uint64_t* a, uint64_t* b, int64_t edge, unsigned int nThreads)
+{
+	const uint64_t* src = in;
+	uint64_t* dst = a;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int64_t p = 1;
+		for (; p * 2 <= edge; p *= 2)
+		{
+			combine(mask, src, dst, axis, 0, -p, false, nThreads);
+			src = dst;
+			dst = (dst == a) ? b : a;
+		}
+		combine(mask, src, dst, axis, 0, -(edge - p), false, nThreads);
+		src = dst;
+		dst = (dst == a) ? b : a;
+	}
+	return(src);
+}
+
+// Word of a packed grid holding bits bit on
+static inline uint64_t packedWord(const uint64_t* bits, int64_t gridWords, int64_t bit)
+{
+	int64_t first = bit >> 6;
+	int rem = (int)(bit & 63);
+	uint64_t value = bits[first] >> rem;
+	if (rem && (first + 1 < gridWords))
+		value |= bits[first + 1] << (64 - rem);
+	return(value);
+}
+
+void granulometry(const uint64_t* bits, const uint64_t* within, int64_t sx, int64_t sy, int64_t sz, bool solid, unsigned int maxEdge, unsigned int nThreads, SizeDistribution& sizes)
+{
+	sizes.opened.clear();
+	sizes.truncated = false;
+
+	PhaseMask mask;
+	mask.sx = sx;
+	mask.sy = sy;
+	mask.sz = sz;
+	mask.rowWords = (sx + 63) / 64;
+	mask.tail = (sx & 63) ? ((1ULL << (sx & 63)) - 1) : ~0ULL;
+
+	std::vector<uint64_t> fits(mask.words());	// Near corners of the boxes that fit (the erosion)
+	std::vector<uint64_t> a(mask.words());
+	std::vector<uint64_t> b(mask.words());
+
+	// The phase of each row, from the packed grid
+	int64_t gridWords = (sx * sy * sz + 63) / 64;
+	parallelFor(sy * sz, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t row = begin; row < end; row++)
+		{
+			uint64_t* dst = &fits[row * mask.rowWords];
+			int64_t base = row * sx;
+			for (int64_t word = 0; word < mask.rowWords; word++)
+			{
+				int64_t bit = base + word * 64;
+				uint64_t value = packedWord(bits, gridWords, bit);
+				dst[word] = solid ? value : ~value;
+				if (within)
+					dst[word] &= packedWord(within, gridWords, bit);
+			}
+			dst[mask.rowWords - 1] &= mask.tail;
+		}
+	});
+
+	for (int64_t edge = 1; ; edge++)
+	{
+		if (edge > 1)
+		{	// Boxes one larger: the erosion by a box of edge 2 on each axis
+			combine(mask, fits.data(), a.data(), 0, 0, 1, true, nThreads);
+			combine(mask, a.data(), b.data(), 1, 0, 1, true, nThreads);
+			combine(mask, b.data(), fits.data(), 2, 0, 1, true, nThreads);
+		}
+		if ((edge > 1) && (countMask(mask, fits.data(), nThreads) == 0))
+			break;	// No box fits
+		if (maxEdge && (edge > maxEdge))
+		{
+			sizes.truncated = true;
+			break;
+		}
+		const uint64_t* opened = (edge == 1) ? fits.data() : dilate(mask, fits.data(), a.data(), b.data(), edge, nThreads);
+		uint64_t count = countMask(mask, opened, nThreads);
+		if (count == 0)
+			break;	// Empty phase
+		sizes.opened.push_back(count);
+	}
+}
@@ -0,0 +1,188 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include "MomentTracker.h"
+#include <math.h>
+#include <string.h>
+
+MomentTracker::MomentTracker()
+{
+	m_rowSize = m_layerSize = 0;
+	clear();
+}
+
+void MomentTracker::clear()
+{
+	m_active = false;
+	m_count = 0;
+	for (int axis = 0; axis < 3; axis++)
+		m_sum[axis] = m_sumSq[axis] = m_sumCross[axis] = 0;
+}
+
+void MomentTracker::build(int xdim, int ydim, int zdim, const uint64_t* solid)
+{
+	clear();
+	m_rowSize = xdim;
+	m_layerSize = m_rowSize * ydim;
+	uint64_t gridSize = m_layerSize * zdim;
+	for (uint64_t word = 0; word < (gridSize + 63) / 64; word++)
+	{
+		uint64_t bits = solid[word];
+		for (uint64_t offset = word << 6; bits; bits >>= 1, offset++)
+		{
+			if (bits & 1)
+				addCube(offset, 1);
+		}
+	}
+
+	m_active = true;
+}
+
+void MomentTracker::addCube(uint64_t offset, int64_t sign)
+{
+	int64_t x = (int64_t)(offset % m_rowSize);
+	int64_t y = (int64_t)((offset % m_layerSize) / m_rowSize);
+	int64_t z = (int64_t)(offset / m_layerSize);
+	m_count += sign;
+	m_sum[0] += sign * x;
+	m_sum[1] += sign * y;
+	m_sum[2] += sign * z;
+	m_sumSq[0] += sign * x * x;
+	m_sumSq[1] += sign * y * y;
+	m_sumSq[2] += sign * z * z;
+	m_sumCross[0] += sign * x * y;
+	m_sumCross[1] += sign * x * z;
+	m_sumCross[2] += sign * y * z;
+}
+
+// Diagonalizes the symmetric 3x3 matrix a with Jacobi rotations.
+// On return the diagonal of a holds the eigenvalues and the columns of v the eigenvectors.
+static void jacobiEigen(double a[3][3], double v[3][3])
+{
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			v[i][j] = (i == j) ? 1.0 : 0.0;
+
+	for (int sweep = 0; sweep < 50; sweep++)
+	{
+		double off = fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]);
+		double scale = fabs(a[0][0]) + fabs(a[1][1]) + fabs(a[2][2]);
+		if (off <= 1e-15 * scale)
+			break;
+		for (int p = 0; p < 2; p++)
+		{
+			for (int q = p + 1; q < 3; q++)
+			{
+				if (a[p][q] == 0.0)
+					continue;
+				double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+				double t = ((theta >= 0.0) ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+				double c = 1.0 / sqrt(t * t + 1.0);
+				double s = t * c;
+				for (int k = 0; k < 3; k++)
+				{	// a = a * R
+					double akp = a[k][p];
+					double akq = a[k][q];
+					a[k][p] = c * akp - s * akq;
+					a[k][q] = s * akp + c * akq;
+				}
+				for (int k = 0; k < 3; k++)
+				{	// a = R' * a
+					double apk = a[p][k];
+					double aqk = a[q][k];
+					a[p][k] = c * apk - s * aqk;
+					a[q][k] = s * apk + c * aqk;
+				}
+				for (int k = 0; k < 3; k++)
+				{	// v = v * R
+					double vkp = v[k][p];
+					double vkq = v[k][q];
+					v[k][p] = c * vkp - s * vkq;
+					v[k][q] = s * vkp + c * vkq;
+				}
+			}
+		}
+	}
+}
+
+bool MomentTracker::getMoments(ShapeMoments& moments)
+{
+	memset(&moments, 0, sizeof(moments));
+	moments.count = m_count;
+	if (m_count == 0)
+		return(false);
+
+	double n = (double)m_count;
+	double mean[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		mean[axis] = m_sum[axis] / n;
+		moments.centroid[axis] = mean[axis] + 0.5;	// Cube centres are half a unit past their indices
+	}
+
+	// Second central moments per cube. Each unit cube adds 1/12 along every axis about its own centre.
+	double cov[3][3];
+	for (int axis = 0; axis < 3; axis++)
+		cov[axis][axis] = m_sumSq[axis] / n - mean[axis] * mean[axis] + 1.0 / 12.0;
+	cov[0][1] = cov[1][0] = m_sumCross[0] / n - mean[0] * mean[1];
+	cov[0][2] = cov[2][0] = m_sumCross[1] / n - mean[0] * mean[2];
+	cov[1][2] = cov[2][1] = m_sumCross[2] / n - mean[1] * mean[2];
+
+	// I = trace(C) * E - C
+	double trace = cov[0][0] + cov[1][1] + cov[2][2];
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			moments.inertia[i][j] = ((i == j) ? trace : 0.0) - cov[i][j];
+
+	double diag[3][3];
+	double vect[3][3];
+	memcpy(diag, moments.inertia, sizeof(diag));
+	jacobiEigen(diag, vect);
+
+	// Smallest moment first (the axis the solid is stretched along)
+	int order[3] = { 0, 1, 2 };
+	for (int i = 0; i < 2; i++)
+		for (int j = i + 1; j < 3; j++)
+			if (diag[order[j]][order[j]] < diag[order[i]][order[i]])
+			{
+				int tmp = order[i];
+				order[i] = order[j];
+				order[j] = tmp;
+			}
+	for (int i = 0; i < 3; i++)
+	{
+		int col = order[i];
+		moments.principal[i] = diag[col][col];
+		int largest = 0;	// Make the largest component positive so the axes don't flip between samples
+		for (int k = 1; k < 3; k++)
+			if (fabs(vect[k][col]) > fabs(vect[largest][col]))
+				largest = k;
+		double sign = (vect[largest][col] < 0.0) ? -1.0 : 1.0;
+		for (int k = 0; k < 3; k++)
+			moments.axes[i][k] = sign * vect[k][col];
+	}
+
+	return(true);
+}
@@ -21,8 +21,6 @@
 	DEALINGS IN THE SOFTWARE.
 ------------------------------------------------------------------------------------*/
 
-#include "cc3d.hpp"		// Connected components labelling library
-
 #include <stdio.h>
 #include <stdarg.h>
 #include <windows.h>
@@ -30,18 +28,31 @@
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <queue>
+#include <functional>
 
 #include "MultiCube.h"
+#include "Parallel.h"
+#include "PoreField.h"
+#include "UnionFind.h"
+#include "FragmentPipeline.h"
 
 extern void sendMessage(std::string& message);
 
 uint64_t xorState;
+uint64_t xorshift64(uint64_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
 uint64_t xorshift64()
 {
-	xorState ^= xorState << 13;
-	xorState ^= xorState >> 7;
-	xorState ^= xorState << 17;
-	return xorState;
+	return(xorshift64(xorState));
 }
 
 void xsrand(uint64_t seed = 0xABADFEEDDEADBEEFULL)
@@ -54,29 +65,17 @@ double xrand()
 	return((double)xorshift64() / (double)ULLONG_MAX);
 }
 
+double xrand(uint64_t& state)
+{
+	return((double)xorshift64(state) / (double)ULLONG_MAX);
+}
+
 // Constructor for MultiCube class
 // Creates a simple 3D data structure as a collection of unit cubes of width*height*depth
 // Each cube face maintains its state based on the presense of an adjacent cube (set if exposed cleared if hidden by an adjacent cube).
 MultiCube::MultiCube(CubeParams& params, bool* doneFlag, char* fname/*=NULL*/) :	m_params(params), m_doneFlag(doneFlag)
 {
-	// Initialize member variables
-	m_saData_fp			= NULL;		// Info output file pointer
-	m_lastRemoved		= -1;		// Used for output data flush
-	m_initialVolume		= 0;
-	m_initialRemoved	= 0;
-	m_cubesRemoved		= 0;
-	m_maxSurfaceArea	= 0;
-	m_particlesGenerated= 0;
-	m_Cubes				= NULL;
-	m_in_labels			= NULL;
-	m_out_labels		= NULL;
-
-#ifdef WANT_FRAGMENTATION
-	m_lastFragmentId	= -1;
-	m_lastIndex			= -1;
-	memset(&m_lastFragInfo, 0, sizeof(m_lastFragInfo));
-	dhist.assign(6, 0);
-#endif //#ifdef WANT_FRAGMENTATION
+	initMembers();
 
 //#define VERIFY_SOURCE	// Uncomment if you wish the PRNG seed to always be the same. (Useful for verifing model after code changes.)
 #ifdef VERIFY_SOURCE
@@ -91,6 +90,14 @@ MultiCube::MultiCube(CubeParams& params, bool* doneFlag, char* fname/*=NULL*/) :
 
 	initialize();		// Allocate and initialize the grid
 	preprocess(fname);	// Create requested shape (cuboid or ellipsoid) and load exposed faces structures
+
+#ifdef WANT_FRAGMENTATION
+	if (m_params.detachFrags && m_params.enableFrag && !useDetachedFragments())
+	{
+		std::string message = format("Detach disabled: not available with the selected fragment, tracking or per increment outputs\n");
+		sendMessage(message);
+	}
+#endif //#ifdef WANT_FRAGMENTATION
 }
 
 // MultiCube class destructor.
@@ -99,14 +106,48 @@ MultiCube::~MultiCube()
 	cleanup();
 }
 
+// Initialize member variables
+void MultiCube::initMembers()
+{
+	m_saData_fp			= NULL;		// Info output file pointer
+	m_lastRemoved		= -1;		// Used for output data flush
+	m_initialVolume		= 0;
+	m_initialRemoved	= 0;
+	m_cubesRemoved		= 0;
+	m_cavityBreached	= false;
+	m_maxSurfaceArea	= 0;
+	m_particlesGenerated= 0;
+	m_Cubes				= NULL;
+	m_rngState			= 0;		// Shared generator
+#ifdef WANT_FRAGMENTATION
+	m_fragPipeline		= NULL;
+#endif //#ifdef WANT_FRAGMENTATION
+
+#ifdef WANT_FRAGMENTATION
+	m_lastFragmentId	= -1;
+	m_lastIndex			= -1;
+	memset(&m_lastFragInfo, 0, sizeof(m_lastFragInfo));
+	dhist.assign(6, 0);
+	m_fragsSeeded		= false;
+	m_liveFragments		= 0;
+	m_recordRemovals	= false;
+	m_detachReady		= false;
+	m_detachDeferred	= false;
+	m_detachedNext		= 0;
+	m_detachedSurface	= 0;
+#endif //#ifdef WANT_FRAGMENTATION
+}
+
 // Free up all allocated memory.
 void MultiCube::cleanup()
 {
-	if (m_in_labels)
-		delete[] m_in_labels;
-
-	if (m_out_labels)
-		delete[] m_out_labels;
+#ifdef WANT_FRAGMENTATION
+	if (m_fragPipeline)
+		delete m_fragPipeline;	// Finishes the queued snapshots
+	m_fragPipeline = NULL;
+	m_fragTracker.clear();
+#endif //#ifdef WANT_FRAGMENTATION
+	releaseLabels();
 
 	if (m_Cubes)
 		delete[] m_Cubes;
@@ -120,10 +161,14 @@ void MultiCube::loadDefaults(CubeParams& params)
 	params.xdim			= 50;
 	params.ydim			= 50;
 	params.zdim			= 50;
+	params.shapeType	= SHAPE_STANDARD;
+	params.shapeE1		= 1.0;
+	params.shapeE2		= 1.0;
 	params.porosity		= 0.0;
 	params.poreSize		= 3;
 	params.poreIsFixed	= true;
 	params.poreIsCuboid	= true;
+	params.poreModel	= PORE_RANDOM;
 	params.withReplacement = true;
 #ifdef RANDOM_REMOVAL
 	params.naiveRemoval = false;
@@ -131,6 +176,16 @@ void MultiCube::loadDefaults(CubeParams& params)
 	params.aggregateEnable = false;
 	params.particleSize = 20;
 	params.replaceEnable= true;
+	params.nThreads		= 0;
+	params.trackVoids	= false;
+	params.trackEuler	= false;
+	params.trackMoments	= false;
+	params.trackFaceAge	= false;
+	params.depthStats	= false;
+	params.fractalDim	= false;
+	params.hullStats	= false;
+	params.granulometry	= false;
+	params.granuleMax	= 0;
 	params.outputInc	= 0.05;
 	params.outputSubsamp= 1;
 	params.outputNSamps = 0;
@@ -147,6 +202,11 @@ void MultiCube::loadDefaults(CubeParams& params)
 	params.histFrags	= false;
 	params.enableFragClass = false;
 	params.fragClass	= 0;
+	params.incrementalFrag = false;
+	params.fragTimeline	= false;
+	params.pipelineFrags = false;
+	params.trackFrags	= false;
+	params.detachFrags	= false;
 #endif //#ifdef WANT_FRAGMENTATION
 #ifdef WANT_INPUT_CONTROL
 	params.inputFile	= "";
@@ -180,16 +240,12 @@ void MultiCube::initialize()
 
 	// 3d arrays represented as 1d arrays
 	m_Cubes = new Cube[m_gridSize]();			// Allocate the 3D grid
+}
 
-	if ((m_params.porosity > 0.0)
-#ifdef WANT_FRAGMENTATION
-		|| m_params.enableFrag
-#endif //#ifdef WANT_FRAGMENTATION
-		)
-	{
-		m_in_labels = new bool[m_gridSize]();			// Allocate the Fragmentation input labelling space
-		m_out_labels = new uint32_t[m_gridSize]();		// Allocate the Fragmentation output labelling space
-	}
+// Uniform random number from the grid's own stream if it has one
+double MultiCube::nextRandom()
+{
+	return(m_rngState ? xrand(m_rngState) : xrand());
 }
 
 int NCollisions = 0;
@@ -212,7 +268,7 @@ void MultiCube::preprocess(char* fname)
 		double zdim = m_params.zdim;
 		double pdim = m_params.particleSize;
 
-		Aggregate aggregate(m_params.cuboid, xdim, ydim, zdim, pdim);
+		Aggregate aggregate(m_params.cuboid, xdim, ydim, zdim, pdim, getThreadCount(m_params.nThreads));
 		pointVect points;
 		point3d cOffset;
 		cOffset.x = 0;
@@ -229,15 +285,7 @@ void MultiCube::preprocess(char* fname)
 			aggregate.generateParticles();
 			points = aggregate.getParticles();
 		}
-		pointVect::iterator it = points.begin();
-		while (it != points.end())
-		{
-			point3d& p = *it++;
-			int x0 = (int)(p.x);
-			int y0 = (int)(p.y);
-			int z0 = (int)(p.z);
-			generateEllipsoid(x0, y0, z0, (int)pdim, (int)pdim, (int)pdim);
-		}
+		stampParticles(points, (int)pdim);	// Rasterize the sub-particles into the grid
 		//detectFragments(true);
 		m_particlesGenerated = points.size();
 
@@ -256,7 +304,9 @@ void MultiCube::preprocess(char* fname)
 		else
 #endif //#ifdef WANT_INPUT_CONTROL
 		{
-			if (m_params.cuboid)	// rectangular solid
+			if (m_params.shapeType != SHAPE_STANDARD)
+				generateShape();	// Cylinder or superellipsoid
+			else if (m_params.cuboid)	// rectangular solid
 				generateCuboid();
 			else					// ellipsoid
 			{
@@ -268,6 +318,8 @@ void MultiCube::preprocess(char* fname)
 		}
 	}
 
+	if (m_params.fractalDim || m_params.depthStats || m_params.outputSaveGrid)	// Only kept for the measurements that use it (the scans alone don't pay for it)
+		m_pyramid.build(m_params.xdim, m_params.ydim, m_params.zdim, getThreadCount(m_params.nThreads), shareSolidBits());
 	initExposedFaceMap();	// Put all exposed faces on the exposed face map
 
 	if (m_params.aggregateEnable && m_params.replaceEnable && NCollisions)
@@ -284,6 +336,13 @@ void MultiCube::preprocess(char* fname)
 	std::string message = format("Initial Volume %lld Total Cubes : Surface Area %lld\n", m_initialVolume, m_maxSurfaceArea);
 	sendMessage(message);
 
+	if (m_params.granulometry)
+	{	// Keep the shape before the pores are made (the void of the size distributions stays inside it)
+		const uint64_t* bits = solidBits(m_shapeBits);
+		if (bits != m_shapeBits.data())
+			m_shapeBits.assign(bits, bits + (m_gridSize + 63) / 64);
+	}
+
 	if ((m_params.porosity > 0.0) 
 #ifdef RANDOM_REMOVAL
 		|| m_params.naiveRemoval
@@ -295,6 +354,15 @@ void MultiCube::preprocess(char* fname)
 	{
 		setupCubeList();
 	}
+
+#ifdef WANT_FRAGMENTATION
+	// Fragment ids live outside the cubes so only fragmentation runs pay for them
+	// (allocated up front so the display thread never sees them being allocated)
+	if (m_params.enableFrag)
+		m_fragIds.assign(m_gridSize, UNINITIALIZED);
+	if (m_params.enableFrag && m_params.animateFrags)
+		m_prevFragIds.assign(m_gridSize, UNINITIALIZED);
+#endif //#ifdef WANT_FRAGMENTATION
 }
 
 // Reserve space for the cube list and index
@@ -365,40 +433,94 @@ void MultiCube::removeFromCubeList(Cube* cube)
 
 void MultiCube::updateCubeList()
 {
-	int64_t totalCubes = getSize();
-
-	Cube* cubePtr = m_Cubes;
-	while (totalCubes--)
+	Dim_t offset = 0;
+	Dim_t end;
+	while ((offset = nextOccupied(offset, end)) < m_gridSize)
 	{
-		if (visible(cubePtr->info))
+		Cube* cubePtr = m_Cubes + offset;
+		for (; offset < end; offset++, cubePtr++)
 		{
-			addToCubeList(cubePtr);
+			if (visible(cubePtr->info))
+			{
+				addToCubeList(cubePtr);
+			}
 		}
-		++cubePtr;
 	}
 }
 
+// Returns the first offset at or after offset that may hold a visible cube (the grid size if none)
+// end receives the end of the cells to check one by one. Without the occupancy pyramid every cell is checked.
+Dim_t MultiCube::nextOccupied(Dim_t offset, Dim_t& end)
+{
+	if (m_pyramid.active())
+	{
+		uint64_t runEnd;
+		offset = m_pyramid.nextOccupied(offset, runEnd);
+		end = runEnd;
+		return(offset);
+	}
+	end = m_gridSize;
+	return(offset);
+}
+
 /****************************************************/
 /* Cube removal/bookkeeping/manipulation routines	*/
 /****************************************************/
 void MultiCube::generateCuboid()
 {
-		// Attach all the pointers (and back pointers)
-	for (int z = 0; z < (int)m_params.zdim; z++)
-	{
-		for (int y = 0; y < (int)m_params.ydim; y++)
-		{
-			for (int x = 0; x < (int)m_params.xdim; x++)
-			{
-				insertCube(x, y, z);
-			}
-		}
+	SpanList spans;
+	ShapeBox box(0, 0, 0, (int)m_params.xdim - 1, (int)m_params.ydim - 1, (int)m_params.zdim - 1);
+	voxelize(box, (int)m_params.xdim, (int)m_params.ydim, (int)m_params.zdim, getThreadCount(m_params.nThreads), spans);
+	insertSpans(spans);
+}
+
+// Generate one of the analytic (non-standard) shapes filling the grid
+void MultiCube::generateShape()
+{
+	double xr = m_params.xdim / 2.0;
+	double yr = m_params.ydim / 2.0;
+	double zr = m_params.zdim / 2.0;
+
+	Shape* shape = NULL;
+	switch (m_params.shapeType) {
+	case SHAPE_CYLINDER:
+		shape = new ShapeCylinder(xr, yr, zr, xr, yr, zr, 2);
+		break;
+	case SHAPE_SUPERELLIPSOID:
+		shape = new ShapeSuperellipsoid(xr, yr, zr, xr, yr, zr, m_params.shapeE1, m_params.shapeE2);
+		break;
+	default:
+		return;
 	}
+
+	SpanList spans;
+	voxelize(*shape, (int)m_params.xdim, (int)m_params.ydim, (int)m_params.zdim, getThreadCount(m_params.nThreads), spans);
+	delete shape;
+
+	insertSpans(spans);
 }
 
 Dim_t MultiCube::generateEllipsoid(int x0, int y0, int z0, int width, int height, int depth, bool remove/*=false*/, bool countOnly/* = false*/)
 {
-	m_insertionCount = 0;
+	SpanList spans;
+	ellipsoidSpans(x0, y0, z0, width, height, depth, spans);
+
+	if (remove)
+	{
+		removeSpans(spans);	// remove used by pore creation
+		return(0);
+	}
+
+	if (!countOnly)
+		insertSpans(spans);
+
+	return((Dim_t)spanVolume(spans));
+}
+
+// Collects the rows of an ellipsoid as x spans
+// Note: The spans are not clipped to the grid
+void MultiCube::ellipsoidSpans(int x0, int y0, int z0, int width, int height, int depth, SpanList& spans)
+{
 	bool rpt = !(depth % 2);
 	if (rpt) --depth;
 
@@ -408,11 +530,8 @@ Dim_t MultiCube::generateEllipsoid(int x0, int y0, int z0, int width, int height
 	int zB = (int)floor(-zradius);
 	for (int z = zA; z > zB; z--)
 	{
-		if (!remove || (remove && ((zpos >= 0) && (zpos < (int)m_params.zdim))))
-		{
-			double zcomp = sqrt(1.0 - ((double)z / zradius)*((double)z / zradius));
-			generateEllipse(x0, y0, zpos, zcomp, width, height, remove, countOnly);
-		}
+		double zcomp = sqrt(1.0 - ((double)z / zradius)*((double)z / zradius));
+		generateEllipse(x0, y0, zpos, zcomp, width, height, spans);
 		++zpos;
 		if (rpt && (z == 0))
 		{
@@ -420,11 +539,9 @@ Dim_t MultiCube::generateEllipsoid(int x0, int y0, int z0, int width, int height
 			rpt = false;
 		}
 	}
-
-	return(m_insertionCount);
 }
 
-void MultiCube::generateEllipse(int x0, int y0, int zpos, double zcomp, int width, int height, bool remove, bool countOnly)
+void MultiCube::generateEllipse(int x0, int y0, int zpos, double zcomp, int width, int height, SpanList& spans)
 {
 	bool yrpt = !(height % 2);
 	if (yrpt) --height;
@@ -432,7 +549,6 @@ void MultiCube::generateEllipse(int x0, int y0, int zpos, double zcomp, int widt
 	double yradius = ((double)height / 2.0)*zcomp;
 
 	bool xrpt = !(width % 2);
-	bool xrpt_org = xrpt;
 	if (xrpt) --width;
 
 	double xradius = ((double)width / 2.0)*zcomp;
@@ -442,42 +558,311 @@ void MultiCube::generateEllipse(int x0, int y0, int zpos, double zcomp, int widt
 	int yB = (int)floor(-yradius);
 	for (int y = yA; y > yB; y--)
 	{
-		if (!remove || (remove && ((ypos >= 0) && (ypos < (int)m_params.ydim))))
+		double yr = (double)y / yradius;
+		double xcomp = sqrt(1.0 - yr * yr) * xradius;		// for ellipses
+		//double xcomp_circ = sqrt(yradius*yradius-y*y);	// for circles
+		int xA = (int)ceil(xcomp - 1);
+		int xB = (int)floor(-xcomp);
+		if (xA > xB)
+		{
+			Span span;
+			span.x0 = (int)floor(x0 - xcomp);
+			span.x1 = span.x0 + (xA - xB - 1) + (xrpt ? 1 : 0);	// Even widths repeat the centre cube
+			span.y = ypos;
+			span.z = zpos;
+			spans.push_back(span);
+		}
+		++ypos;
+		if (yrpt && (y == 0))
+		{
+			++y;
+			yrpt = false;
+		}
+	}
+}
+
+// Recompute the face state of a visible cube from its neighbors
+// Only valid before the exposed face map is built (see initExposedFaceMap())
+void MultiCube::refreshFaces(Cube* cube, int x, int y, int z)
+{
+	cube->info &= ~EXPOSED_MASK;
+	if ((x == 0) || !visible(getAdjacentCube(cube, 1)->info))
+		setFaceBit(cube->info, 1);
+	if ((y == 0) || !visible(getAdjacentCube(cube, 2)->info))
+		setFaceBit(cube->info, 2);
+	if ((z == 0) || !visible(getAdjacentCube(cube, 0)->info))
+		setFaceBit(cube->info, 0);
+	if ((x == (int)m_params.xdim - 1) || !visible(getAdjacentCube(cube, 4)->info))
+		setFaceBit(cube->info, 4);
+	if ((y == (int)m_params.ydim - 1) || !visible(getAdjacentCube(cube, 3)->info))
+		setFaceBit(cube->info, 3);
+	if ((z == (int)m_params.zdim - 1) || !visible(getAdjacentCube(cube, 5)->info))
+		setFaceBit(cube->info, 5);
+}
+
+// Inserts all cubes covered by the spans (clipped to the grid).
+// Equivalent to insertCube() on each cube. Large insertions are written in bulk:
+//	1) the cubes are made visible concurrently (one thread per block of spans)
+//	2) the face state of every cube on (or beside) an affected row is then rebuilt concurrently (one thread per block of rows)
+// Returns the number of cubes inserted
+Dim_t MultiCube::insertSpans(const SpanList& spans)
+{
+	int xdim = (int)m_params.xdim;
+	int ydim = (int)m_params.ydim;
+	int zdim = (int)m_params.zdim;
+
+	Dim_t volume = 0;
+	SpanList::const_iterator it = spans.begin();
+	while (it != spans.end())
+	{
+		const Span& span = *it++;
+		if ((span.y >= 0) && (span.y < ydim) && (span.z >= 0) && (span.z < zdim))
+		{
+			int x0 = (span.x0 < 0) ? 0 : span.x0;
+			int x1 = (span.x1 >= xdim) ? xdim - 1 : span.x1;
+			if (x0 <= x1)
+				volume += x1 - x0 + 1;
+		}
+	}
+
+	Dim_t initialVolume = m_initialVolume;
+	if (volume < BULK_INSERT_MIN)
+	{	// Small insertions (e.g. aggregate sub-particles) are cheaper one cube at a time
+		it = spans.begin();
+		while (it != spans.end())
+		{
+			const Span& span = *it++;
+			if ((span.y < 0) || (span.y >= ydim) || (span.z < 0) || (span.z >= zdim))
+				continue;
+			int x0 = (span.x0 < 0) ? 0 : span.x0;
+			int x1 = (span.x1 >= xdim) ? xdim - 1 : span.x1;
+			for (int x = x0; x <= x1; x++)
+				insertCube(x, span.y, span.z);
+		}
+		return(m_initialVolume - initialVolume);
+	}
+
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+	Dim_t nRows = (Dim_t)ydim * zdim;
+
+	// Track the x extent of every row whose face state must be rebuilt
+	std::vector<int> rowMin(nRows, xdim);
+	std::vector<int> rowMax(nRows, -1);
+	it = spans.begin();
+	while (it != spans.end())
+	{
+		const Span& span = *it++;
+		if ((span.y < 0) || (span.y >= ydim) || (span.z < 0) || (span.z >= zdim))
+			continue;
+		int x0 = (span.x0 < 0) ? 0 : span.x0;
+		int x1 = (span.x1 >= xdim) ? xdim - 1 : span.x1;
+		if (x0 > x1)
+			continue;
+
+		static const int adjRows[5][2] = { {0, 0}, {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+		for (int i = 0; i < 5; i++)
+		{
+			int y = span.y + adjRows[i][0];
+			int z = span.z + adjRows[i][1];
+			if ((y < 0) || (y >= ydim) || (z < 0) || (z >= zdim))
+				continue;
+			Dim_t row = (Dim_t)z * ydim + y;
+			int xa = i ? x0 : ((x0 > 0) ? x0 - 1 : 0);	// The row itself also has neighbors at each end
+			int xb = i ? x1 : ((x1 < xdim - 1) ? x1 + 1 : x1);
+			if (xa < rowMin[row])
+				rowMin[row] = xa;
+			if (xb > rowMax[row])
+				rowMax[row] = xb;
+		}
+	}
+
+	// Pass 1: Make the cubes visible. Spans never overlap so no two threads touch the same cube.
+	std::vector<Dim_t> inserted(nThreads, 0);
+	std::vector<Dim_t> collisions(nThreads, 0);
+	parallelFor((int64_t)spans.size(), nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		for (int64_t i = begin; i < end; i++)
 		{
-			xrpt = xrpt_org;
-			double yr = (double)y / yradius;
-			double xcomp = sqrt(1.0 - yr * yr) * xradius;		// for ellipses
-			//double xcomp_circ = sqrt(yradius*yradius-y*y);	// for circles
-			int xpos = (int)floor(x0 - xcomp);
-			int xA = (int)ceil(xcomp - 1);
-			int xB = (int)floor(-xcomp);
-			for (int x = xA; x > xB; x--)
+			const Span& span = spans[i];
+			if ((span.y < 0) || (span.y >= ydim) || (span.z < 0) || (span.z >= zdim))
+				continue;
+			int x0 = (span.x0 < 0) ? 0 : span.x0;
+			int x1 = (span.x1 >= xdim) ? xdim - 1 : span.x1;
+			Cube* cube = getCube(x0, span.y, span.z);
+			for (int x = x0; x <= x1; x++, cube++)
 			{
-				if (remove)
-				{
-					if ((xpos >= 0) && (xpos < (int)m_params.xdim))
-						removeCube(xpos, ypos, zpos);	// remove used by pore creation
-				}
+				if (visible(cube->info))
+					++collisions[thread];	// Already visible in the grid
 				else
 				{
-					++m_insertionCount;
-					if (!countOnly)
-						insertCube(xpos, ypos, zpos);
+					show(cube->info);
+					++inserted[thread];
 				}
-				++xpos;
-				if (xrpt && (x == 0))
+			}
+		}
+	});
+
+	// Pass 2: Rebuild the face state of the affected rows
+	parallelFor((int64_t)nRows, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t row = begin; row < end; row++)
+		{
+			if (rowMax[row] < 0)
+				continue;
+			int y = (int)(row % ydim);
+			int z = (int)(row / ydim);
+			Cube* cube = getCube(rowMin[row], y, z);
+			for (int x = rowMin[row]; x <= rowMax[row]; x++, cube++)
+			{
+				if (visible(cube->info))
+					refreshFaces(cube, x, y, z);
+			}
+		}
+	});
+
+	for (unsigned int t = 0; t < nThreads; t++)
+	{
+		m_initialVolume += inserted[t];
+		NCollisions += (int)collisions[t];
+	}
+
+	return(m_initialVolume - initialVolume);
+}
+
+// Inserts a spherical particle of the given size centered on each point (equivalent to generateEllipsoid() on each point).
+// The sphere is rasterized once into a span template which is then stamped at every point.
+// Each thread owns a slab of z layers and stamps the parts of the particles falling in its slab, so no two threads
+// touch the same cube and the collision count doesn't depend on the thread count.
+// The face state of the stamped cubes is rebuilt afterwards in a single pass.
+// Returns the number of cubes inserted
+Dim_t MultiCube::stampParticles(const pointVect& points, int size)
+{
+	int xdim = (int)m_params.xdim;
+	int ydim = (int)m_params.ydim;
+	int zdim = (int)m_params.zdim;
+
+	if (points.empty() || (size < 1))
+		return(0);
+
+	SpanList stamp;
+	ellipsoidSpans(0, 0, 0, size, size, size, stamp);	// Spans are relative to the particle center
+	if (stamp.empty())
+		return(0);
+	int dzMin = stamp.front().z;
+	int dzMax = stamp.back().z;
+
+	// Order the particles by layer so each slab only visits the particles that can reach it
+	std::vector<std::pair<int, int> > order(points.size());
+	for (size_t i = 0; i < points.size(); i++)
+		order[i] = std::make_pair((int)points[i].z, (int)i);
+	std::sort(order.begin(), order.end());
+
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+	std::vector<Dim_t> inserted(nThreads, 0);
+	std::vector<Dim_t> collisions(nThreads, 0);
+	std::vector<char> rowTouched((size_t)ydim * zdim, 0);
+	parallelFor((int64_t)zdim, nThreads, [&](int64_t zBegin, int64_t zEnd, unsigned int thread)
+	{
+		std::vector<std::pair<int, int> >::const_iterator pit = std::lower_bound(order.begin(), order.end(), std::make_pair((int)zBegin - dzMax, -1));
+		for (; (pit != order.end()) && (pit->first + dzMin < zEnd); ++pit)
+		{
+			const point3d& p = points[pit->second];
+			int x0 = (int)(p.x);
+			int y0 = (int)(p.y);
+			int z0 = (int)(p.z);
+			SpanList::const_iterator sit = stamp.begin();
+			while (sit != stamp.end())
+			{
+				const Span& span = *sit++;
+				int y = span.y + y0;
+				int z = span.z + z0;
+				if ((z < zBegin) || (z >= zEnd) || (y < 0) || (y >= ydim))
+					continue;
+				int xa = span.x0 + x0;
+				int xb = span.x1 + x0;
+				if (xa < 0)
+					xa = 0;
+				if (xb >= xdim)
+					xb = xdim - 1;
+				if (xa > xb)
+					continue;
+				rowTouched[(size_t)z * ydim + y] = 1;
+				Cube* cube = getCube(xa, y, z);
+				for (int x = xa; x <= xb; x++, cube++)
 				{
-					++x;
-					xrpt = false;
+					if (visible(cube->info))
+						++collisions[thread];	// Already visible in the grid
+					else
+					{
+						show(cube->info);
+						++inserted[thread];
+					}
 				}
 			}
 		}
-		++ypos;
-		if (yrpt && (y == 0))
+	});
+
+	// Rebuild the face state of every cube on (or beside) a stamped row
+	parallelFor((int64_t)zdim, nThreads, [&](int64_t zBegin, int64_t zEnd, unsigned int)
+	{
+		for (int z = (int)zBegin; z < (int)zEnd; z++)
 		{
-			++y;
-			yrpt = false;
+			for (int y = 0; y < ydim; y++)
+			{
+				static const int adjRows[5][2] = { {0, 0}, {-1, 0}, {1, 0}, {0, -1}, {0, 1} };
+				bool touched = false;
+				for (int i = 0; (i < 5) && !touched; i++)
+				{
+					int yy = y + adjRows[i][0];
+					int zz = z + adjRows[i][1];
+					if ((yy >= 0) && (yy < ydim) && (zz >= 0) && (zz < zdim))
+						touched = (rowTouched[(size_t)zz * ydim + yy] != 0);
+				}
+				if (!touched)
+					continue;
+				Cube* cube = getCube(0, y, z);
+				for (int x = 0; x < xdim; x++, cube++)
+				{
+					if (visible(cube->info))
+						refreshFaces(cube, x, y, z);
+				}
+			}
 		}
+	});
+
+	Dim_t initialVolume = m_initialVolume;
+	for (unsigned int t = 0; t < nThreads; t++)
+	{
+		m_initialVolume += inserted[t];
+		NCollisions += (int)collisions[t];
+	}
+
+	return(m_initialVolume - initialVolume);
+}
+
+// Removes all cubes covered by the spans offset by (dx,dy,dz). Cubes outside the grid are ignored.
+void MultiCube::removeSpans(const SpanList& spans, int dx/*=0*/, int dy/*=0*/, int dz/*=0*/)
+{
+	int xdim = (int)m_params.xdim;
+	int ydim = (int)m_params.ydim;
+	int zdim = (int)m_params.zdim;
+
+	SpanList::const_iterator it = spans.begin();
+	while (it != spans.end())
+	{
+		const Span& span = *it++;
+		int y = span.y + dy;
+		int z = span.z + dz;
+		if ((y < 0) || (y >= ydim) || (z < 0) || (z >= zdim))
+			continue;
+		int x0 = span.x0 + dx;
+		int x1 = span.x1 + dx;
+		if (x0 < 0)
+			x0 = 0;
+		if (x1 >= xdim)
+			x1 = xdim - 1;
+		for (int x = x0; x <= x1; x++)
+			removeCube(x, y, z);
 	}
 }
 
@@ -485,22 +870,25 @@ void MultiCube::generateEllipse(int x0, int y0, int zpos, double zcomp, int widt
 // These are simply the faces on outer surface of the cubes that make up the 3D grid object
 void MultiCube::initExposedFaceMap()
 {
-	Cube* cube = m_Cubes;
-	Dim_t totalCubes = getSize();
-	while (totalCubes--)
+	Dim_t offset = 0;
+	Dim_t end;
+	while ((offset = nextOccupied(offset, end)) < m_gridSize)
 	{
-		if (visible(cube->info))
+		Cube* cube = m_Cubes + offset;
+		for (; offset < end; offset++, cube++)
 		{
-			int face = NUMFACES;
-			while (face--)
+			if (visible(cube->info))
 			{
-				if (isExposed(cube->info, face))
+				int face = NUMFACES;
+				while (face--)
 				{
-					addFace(cube, face);
+					if (isExposed(cube->info, face))
+					{
+						addFace(cube, face);
+					}
 				}
 			}
 		}
-		++cube;
 	}
 	surfaceMap = exposedMap;	// Copy the exposed map for later use replacing cubes (see replaceCubes())
 
@@ -612,6 +1000,8 @@ void MultiCube::addFace(Cube* cube, int face)
 	else
 #endif //#ifdef HAS_WXWIDGETS
 		exposedList.push_back(key);
+	if (m_faceAges.active())
+		exposedSince.push_back(m_cubesRemoved);
 }
 
 // Remove a face from the exposed face map and list
@@ -628,6 +1018,12 @@ void MultiCube::removeFace(Key_t key)
 	if (it == exposedMap.end())
 		return;	// Not on the map. Nothing to do.
 	Key_t lastKey = exposedList.back();
+	if (m_faceAges.active())
+	{	// Retire the face's age and keep the ages in step with the list
+		m_faceAges.retire(m_cubesRemoved - exposedSince[it->second]);
+		exposedSince[it->second] = exposedSince.back();
+		exposedSince.pop_back();
+	}
 	if (lastKey != key)
 	{
 		CubeMap::iterator nit = exposedMap.find(lastKey);
@@ -652,18 +1048,42 @@ void MultiCube::removeFace(Key_t key)
 // Deletes a cube from the active cube list and set its removed flag to true
 void MultiCube::deleteCube(Cube* cube)
 {
-	hide(cube->info);	// No longer "visible"
+	markRemoved(cube);
 	if (!cubeList.empty())
 		removeFromCubeList(cube);
 }
 
+// Sets the cube's removed flag (and logs the removal for the timeline and void tracking)
+void MultiCube::markRemoved(Cube* cube)
+{
+	Dim_t offset = getOffset(cube);
+#ifdef WANT_FRAGMENTATION
+	if (m_recordRemovals)
+		m_removalLog.push_back(offset);
+#endif //#ifdef WANT_FRAGMENTATION
+	if (m_voids.active() && m_voids.removeCube(offset))
+		m_cavityBreached = true;
+	if (!m_solidBits.empty() && ((m_solidBits[offset >> 6] >> (offset & 63)) & 1))
+	{	// The trackers only see each cube leave once
+		m_solidBits[offset >> 6] &= ~(1ULL << (offset & 63));
+		if (m_euler.active())
+			m_euler.removeCube(offset);
+		if (m_moments.active())
+			m_moments.removeCube(offset);
+		if (m_pyramid.active())
+			m_pyramid.removeCube(offset);
+	}
+	hide(cube->info);	// No longer "visible"
+}
+
 // Removes a cube from the 3D grid.
-void MultiCube::removeCube(Cube* cube)
+// Returns the cube removed (cubes of any enclosed pore opened up by the removal are removed as well)
+Cube* MultiCube::removeCube(Cube* cube)
 {
 	if (cube == NULL)
 	{
 		// Retrieve the to-be-removed cube's id using the randomly selected index into the exposed face list
-		Dim_t index = (Dim_t)(xrand() * exposedList.size());
+		Dim_t index = (Dim_t)(nextRandom() * exposedList.size());
 		cube = getCube(exposedList[index]);
 	}
 
@@ -703,13 +1123,16 @@ void MultiCube::removeCube(Cube* cube)
 		deleteCube(cube);	// Remove cube from active cube list
 		++cubeIndex;
 	}
+
+	return(tbrCubes[0]);
 }
 
 // Removes a cube from the 3D grid.
-void MultiCube::removeCube()
+// Returns the cube removed
+Cube* MultiCube::removeCube()
 {
 	// Retrieve the to-be-removed cube using the randomly selected index into the exposed face list
-	Dim_t index = (Dim_t)(xrand() * exposedList.size());
+	Dim_t index = (Dim_t)(nextRandom() * exposedList.size());
 	Cube* cube = getCube(exposedList[index]);
 	int face = NUMFACES;
 	while (face--)
@@ -721,6 +1144,8 @@ void MultiCube::removeCube()
 	}
 
 	deleteCube(cube);	// Mark as removed (no longer "visible") and remove cube from active cube list if used
+
+	return(cube);
 }
 
 // Attaches the faces of two adjacent cubes and if doUpdate is true,
@@ -775,6 +1200,20 @@ Cube* MultiCube::insertCube(int x, int y, int z, bool doUpdate/*=false*/)
 		return(NULL);	// Already visible in the grid - nothing to do
 	}
 
+	if (m_voids.active())
+		m_voids.clear();	// Void can't be filled in incrementally. Rebuilt when consuming starts.
+	Dim_t offset = getOffset(cube);
+	if (!m_solidBits.empty() && !((m_solidBits[offset >> 6] >> (offset & 63)) & 1))
+	{
+		m_solidBits[offset >> 6] |= 1ULL << (offset & 63);
+		if (m_euler.active())
+			m_euler.insertCube(offset);
+		if (m_moments.active())
+			m_moments.insertCube(offset);
+		if (m_pyramid.active())
+			m_pyramid.insertCube(offset);
+	}
+
 	show(cube->info);	// Make cube visible in the grid
 	Cube* adjCube = NULL;
 	
@@ -872,7 +1311,7 @@ void MultiCube::removePore(Cube* cube, int poreSize)
 	{
 		if (poreSize > 2)
 		{
-			generateEllipsoid(xpos, ypos, zpos, poreSize, poreSize, poreSize, true);
+			removeSpans(getPoreTemplate(poreSize), xpos, ypos, zpos);
 			return;
 		}
 	}
@@ -906,51 +1345,428 @@ void MultiCube::removePore(Cube* cube, int poreSize)
 		removeCube(*it++);
 }
 
-void MultiCube::resetExpectedVolume(Dim_t expectedVolume)
+// Labels the void of the grid. From here on the void connectivity is updated as cubes are deleted.
+void MultiCube::startVoidTracking()
 {
-	std::string message;
-
-	Dim_t surfaceArea;
-	Dim_t volume = getVolume(&surfaceArea);
-
-	// Replace any missing cubes caused by porosity and fragmentation
-	int missingCubes = (int)(expectedVolume - volume);
-	if (missingCubes)
+	if (m_gridSize > VoidTracker::maxGridSize())
 	{
-		replaceCubes(missingCubes);
-		
-		//detectFragments(true);	// Fragmentation Verification (Must return 1 - If not something went wrong)
-
-		volume = getVolume(&surfaceArea);
-		message = format("After Replacing %d Cubes - %lld Total Cubes - %lld exposed faces\n", missingCubes, volume, surfaceArea);
+		std::string message = format("Void tracking disabled: the grid has more than %lld cells\n", (Dim_t)VoidTracker::maxGridSize());
 		sendMessage(message);
+		m_params.trackVoids = false;
+		return;
 	}
 
-#ifdef WANT_FRAGMENTATION
-	if (!m_params.enableFrag)
+	m_voids.build(m_params.xdim, m_params.ydim, m_params.zdim, [&](uint64_t offset) { return(visible(m_Cubes[offset].info) != 0); });
+	m_cavityBreached = false;
+
+	std::string message = format("Void tracking: %lld enclosed cavities (%lld cubes)\n", m_voids.cavities(), m_voids.enclosedVolume());
+	sendMessage(message);
+}
+
+void MultiCube::startEulerTracking()
+{
+	m_euler.build(m_params.xdim, m_params.ydim, m_params.zdim, shareSolidBits());
+
+	std::string message = format("Euler tracking: Euler characteristic %lld\n", m_euler.euler());
+	sendMessage(message);
+}
+
+void MultiCube::startMomentTracking()
+{
+	m_moments.build(m_params.xdim, m_params.ydim, m_params.zdim, shareSolidBits());
+
+	ShapeMoments moments;
+	m_moments.getMoments(moments);
+	std::string message = format("Moment tracking: %lld cubes centred at (%g, %g, %g)\n", (Dim_t)moments.count, moments.centroid[0], moments.centroid[1], moments.centroid[2]);
+	sendMessage(message);
+}
+
+bool MultiCube::getShapeMoments(ShapeMoments& moments)
+{
+	if (!m_moments.active())
 	{
-		delete [] m_in_labels;	// No longer needed
-		m_in_labels = NULL;
-		delete[] m_out_labels;	// No longer needed
-		m_out_labels = NULL;
+		memset(&moments, 0, sizeof(moments));
+		return(false);
 	}
-#endif //#ifdef WANT_FRAGMENTATION
+	return(m_moments.getMoments(moments));
 }
 
-// Reinserts cubes that were removed due to fragmentation or porosity
-// This is necessary when consistent/reproducable starting volumes are important
-// Note: We prevent the replacement of cubes on original surface faces. 
-// i.e. the shape will never exceed its original boundaries.
-void MultiCube::replaceCubes(int nCubes, bool excludeSurface/*=true*/)
+// Exposure times start now. The faces already exposed count as exposed now.
+void MultiCube::startFaceAgeTracking()
 {
-	std::string message = format("Replacing %d cubes\n", nCubes);
+	m_faceAges.start();
+	exposedSince.assign(exposedList.size(), m_cubesRemoved);
+
+	std::string message = format("Face age tracking: %lld exposed faces\n", (Dim_t)exposedList.size());
 	sendMessage(message);
+}
 
-	int origExposedFaces = (int)exposedList.size();		// Number of exposed faces originally available.
-	while (nCubes--)
-	{
-		int exposedFaces = (int)exposedList.size();		// Number of exposed faces currently available.
-		Key_t key;
+bool MultiCube::getFaceAges(std::vector<uint64_t>& current, std::vector<uint64_t>& retired)
+{
+	current.clear();
+	retired.clear();
+	if (!m_faceAges.active())
+		return(false);
+	FaceAgeSpectrum::surface(exposedSince, m_cubesRemoved, current);
+	retired = m_faceAges.retired();
+	return(true);
+}
+
+bool MultiCube::outputFaceAges(char* filename)
+{
+	if (!m_faceAges.active())
+		return(false);
+	std::vector<uint64_t> current;
+	FaceAgeSpectrum::surface(exposedSince, m_cubesRemoved, current);
+	return(m_faceAges.output(filename, current));
+}
+
+// The solid bit-packed (x fastest): the shared bits when they're kept, else filled into solid
+const uint64_t* MultiCube::solidBits(std::vector<uint64_t>& solid)
+{
+	if (!m_solidBits.empty())
+		return(m_solidBits.data());
+
+	solid.resize((m_gridSize + 63) / 64);
+	parallelFor((int64_t)solid.size(), getThreadCount(m_params.nThreads), [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t word = begin; word < end; word++)
+		{
+			uint64_t bits = 0;
+			Dim_t offset = (Dim_t)word << 6;
+			Dim_t count = std::min((Dim_t)64, m_gridSize - offset);
+			for (Dim_t bit = 0; bit < count; bit++)
+			{
+				if (visible(m_Cubes[offset + bit].info))
+					bits |= 1ULL << bit;
+			}
+			solid[word] = bits;
+		}
+	});
+	return(solid.data());
+}
+
+// The solid bits shared by the trackers and the pyramid (filled by the first of them, then kept up to date by markRemoved())
+const uint64_t* MultiCube::shareSolidBits()
+{
+	if (m_solidBits.empty())
+		solidBits(m_solidBits);
+	return(m_solidBits.data());
+}
+
+// Measures the depth of every cube of the solid
+void MultiCube::getDepthStats(DepthStats& stats)
+{
+	std::chrono::system_clock::time_point before = std::chrono::system_clock::now();
+
+	std::vector<uint64_t> solid;
+	const uint64_t* bits = solidBits(solid);
+	depthTransform(bits, m_params.xdim, m_params.ydim, m_params.zdim, getThreadCount(m_params.nThreads), stats);
+
+	std::chrono::duration<double> duration = std::chrono::system_clock::now() - before;
+	std::string message = format("Depth: %lld cubes, mean %.3lf, maximum inscribed radius %.3lf (%.2lf(s))\n", (Dim_t)stats.solid, stats.meanDepth, stats.maxDepth(), duration.count());
+	sendMessage(message);
+}
+
+// Writes a line per unit of depth: first depth, cubes
+bool MultiCube::outputDepths(char* filename)
+{
+	DepthStats stats;
+	getDepthStats(stats);
+
+	FILE* fp = fopen(filename, "w+");
+	if (fp == NULL)
+		return(false);
+	for (size_t bin = 0; bin < stats.histogram.size(); bin++)
+		fprintf(fp, "%zu,%llu\n", bin, (unsigned long long)stats.histogram[bin]);
+	fclose(fp);
+
+	return(true);
+}
+
+// Size distributions of the void (pores and removed cubes inside the original shape) and of the solid
+void MultiCube::getGranulometry(SizeDistribution& voids, SizeDistribution& solid)
+{
+	std::chrono::system_clock::time_point before = std::chrono::system_clock::now();
+
+	std::vector<uint64_t> packed;
+	const uint64_t* bits = solidBits(packed);
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+	granulometry(bits, m_shapeBits.empty() ? NULL : m_shapeBits.data(), m_params.xdim, m_params.ydim, m_params.zdim, false, m_params.granuleMax, nThreads, voids);
+	granulometry(bits, NULL, m_params.xdim, m_params.ydim, m_params.zdim, true, m_params.granuleMax, nThreads, solid);
+
+	std::chrono::duration<double> duration = std::chrono::system_clock::now() - before;
+	std::string message = format("Granulometry: void mean size %.3lf (largest %d), solid mean size %.3lf (largest %d) (%.2lf(s))\n",
+		voids.meanSize(), (int)voids.opened.size(), solid.meanSize(), (int)solid.opened.size(), duration.count());
+	sendMessage(message);
+}
+
+// Writes a line per box edge: edge, void cubes of that size, solid cubes of that size
+bool MultiCube::outputGranulometry(char* filename)
+{
+	SizeDistribution voids, solid;
+	getGranulometry(voids, solid);
+
+	FILE* fp = fopen(filename, "w+");
+	if (fp == NULL)
+		return(false);
+	size_t sizes = std::max(voids.opened.size(), solid.opened.size());
+	for (size_t edge = 1; edge <= sizes; edge++)
+	{
+		uint64_t voidCubes = (edge <= voids.opened.size()) ? voids.sized(edge) : 0;
+		uint64_t solidCubes = (edge <= solid.opened.size()) ? solid.sized(edge) : 0;
+		fprintf(fp, "%zu,%llu,%llu\n", edge, (unsigned long long)voidCubes, (unsigned long long)solidCubes);
+	}
+	fclose(fp);
+
+	return(true);
+}
+
+// Hull of the exposed cubes (every cube with a face on the surface, internal pore surfaces included)
+void MultiCube::getHullStats(HullStats& stats)
+{
+	cubeHull(exposedList.data(), exposedList.size(), POSITION_SHIFT, m_params.xdim, m_params.ydim, getThreadCount(m_params.nThreads), stats);
+}
+
+// Adds the hull of the surface and the shape ratios to a sample.
+void MultiCube::measureHull(HullSample& sample, Dim_t surfaceArea)
+{
+	HullStats hull;
+	getHullStats(hull);
+	if (hull.volume <= 0.0)
+		return;
+
+	double volume = (double)(m_initialVolume - m_cubesRemoved);
+	sample.volume = hull.volume;
+	sample.area = hull.area;
+	sample.sphericity = surfaceArea ? pow(M_PI, 1.0 / 3.0) * pow(6.0 * volume, 2.0 / 3.0) / (double)surfaceArea : 0.0;
+	sample.convexity = volume / hull.volume;
+}
+
+// Returns the spans of a spherical pore centred on the origin.
+// Pores are translation invariant so each pore size is only voxelised once.
+const SpanList& MultiCube::getPoreTemplate(int poreSize)
+{
+	std::map<int, SpanList>::iterator it = m_poreTemplates.find(poreSize);
+	if (it != m_poreTemplates.end())
+		return(it->second);
+
+	SpanList& spans = m_poreTemplates[poreSize];
+	ellipsoidSpans(0, 0, 0, poreSize, poreSize, poreSize, spans);
+	return(spans);
+}
+
+// Removes exactly cubesToRemove cubes using a spatially correlated noise field.
+// White noise is smoothed with separable filters of width poreSize and the remaining cubes with the
+// lowest field values are removed. The threshold is found with a histogram of the field values
+// with the boundary bin resolved exactly.
+// Removed regions connected to the exposed surface are opened up (as removeCube() would) while
+// enclosed regions are simply deleted (as removePore() does with cubes having no exposed face).
+// Returns the number of cubes removed
+Dim_t MultiCube::generateCorrelatedPores(Dim_t cubesToRemove)
+{
+	int xdim = (int)m_params.xdim;
+	int ydim = (int)m_params.ydim;
+	int zdim = (int)m_params.zdim;
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+
+	Dim_t nCubes = (Dim_t)cubeList.size();
+	if (cubesToRemove > nCubes)
+		cubesToRemove = nCubes;
+	if (cubesToRemove <= 0)
+		return(0);
+
+	std::vector<float> field;
+	generateNoiseField(field, xdim, ydim, zdim, xorshift64(), nThreads);
+	int filter = (m_params.poreModel == PORE_CORRELATED_GAUSSIAN) ? FIELD_FILTER_GAUSSIAN : FIELD_FILTER_BOX;
+	smoothField(field, xdim, ydim, zdim, filter, (double)m_params.poreSize, nThreads);
+
+	// Range of the field over the remaining cubes
+	std::vector<float> minValues(nThreads, 1.0f), maxValues(nThreads, 0.0f);
+	parallelFor((int64_t)nCubes, nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		for (int64_t i = begin; i < end; i++)
+		{
+			float value = field[cubeList[i] - m_Cubes];
+			if (value < minValues[thread])
+				minValues[thread] = value;
+			if (value > maxValues[thread])
+				maxValues[thread] = value;
+		}
+	});
+	float minValue = minValues[0], maxValue = maxValues[0];
+	for (unsigned int t = 1; t < nThreads; t++)
+	{
+		minValue = (minValues[t] < minValue) ? minValues[t] : minValue;
+		maxValue = (maxValues[t] > maxValue) ? maxValues[t] : maxValue;
+	}
+	double scale = (maxValue > minValue) ? (FIELD_HISTOGRAM_BINS / ((double)maxValue - minValue)) : 0.0;
+	auto getBin = [&](float value) -> int
+	{
+		int bin = (int)(((double)value - minValue) * scale);
+		return((bin < FIELD_HISTOGRAM_BINS) ? bin : FIELD_HISTOGRAM_BINS - 1);
+	};
+
+	// Histogram of the field values (one per thread then merged)
+	std::vector<std::vector<Dim_t> > histograms(nThreads, std::vector<Dim_t>(FIELD_HISTOGRAM_BINS, 0));
+	parallelFor((int64_t)nCubes, nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		std::vector<Dim_t>& histogram = histograms[thread];
+		for (int64_t i = begin; i < end; i++)
+			++histogram[getBin(field[cubeList[i] - m_Cubes])];
+	});
+	for (unsigned int t = 1; t < nThreads; t++)
+	{
+		for (int bin = 0; bin < FIELD_HISTOGRAM_BINS; bin++)
+			histograms[0][bin] += histograms[t][bin];
+	}
+
+	// Find the bin holding the threshold. Everything below it is removed plus the lowest values from the bin itself.
+	int thresholdBin = 0;
+	Dim_t below = 0;
+	while (below + histograms[0][thresholdBin] < cubesToRemove)
+		below += histograms[0][thresholdBin++];
+	Dim_t fromBin = cubesToRemove - below;
+
+	// Gather the cubes to be removed (in cube list order so the result doesn't depend on the thread count)
+	std::vector<CubePtrs> removals(nThreads), boundary(nThreads);
+	parallelFor((int64_t)nCubes, nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		for (int64_t i = begin; i < end; i++)
+		{
+			Cube* cube = cubeList[i];
+			int bin = getBin(field[cube - m_Cubes]);
+			if (bin < thresholdBin)
+				removals[thread].push_back(cube);
+			else if (bin == thresholdBin)
+				boundary[thread].push_back(cube);
+		}
+	});
+	CubePtrs tbrCubes, boundaryCubes;
+	tbrCubes.reserve(cubesToRemove);
+	for (unsigned int t = 0; t < nThreads; t++)
+	{
+		tbrCubes.insert(tbrCubes.end(), removals[t].begin(), removals[t].end());
+		boundaryCubes.insert(boundaryCubes.end(), boundary[t].begin(), boundary[t].end());
+	}
+	std::nth_element(boundaryCubes.begin(), boundaryCubes.begin() + (fromBin - 1), boundaryCubes.end(), [&](Cube* a, Cube* b)
+	{
+		float va = field[a - m_Cubes];
+		float vb = field[b - m_Cubes];
+		return((va < vb) || ((va == vb) && (a < b)));
+	});
+	tbrCubes.insert(tbrCubes.end(), boundaryCubes.begin(), boundaryCubes.begin() + fromBin);
+	field.clear();
+	field.shrink_to_fit();
+
+	// Mark the cubes and find the removed regions reachable from the exposed surface
+	// (Cubes deleted earlier and adjacent to a breached region are reopened too, as removeCube() does)
+	enum { KEEP = 0, ENCLOSED, BREACHED };
+	std::vector<char> marks(m_gridSize, KEEP);
+	CubePtrs breached;
+	CubePtrs::iterator it = tbrCubes.begin();
+	while (it != tbrCubes.end())
+	{
+		Cube* cube = *it++;
+		hide(cube->info);
+		marks[cube - m_Cubes] = ENCLOSED;
+	}
+	it = tbrCubes.begin();
+	while (it != tbrCubes.end())
+	{
+		Cube* cube = *it++;
+		if (hasExposed(cube->info))
+		{
+			marks[cube - m_Cubes] = BREACHED;
+			breached.push_back(cube);
+		}
+	}
+	for (size_t index = 0; index < breached.size(); index++)
+	{
+		Cube* cube = breached[index];
+		int face = NUMFACES;
+		while (face--)
+		{
+			if (isExposed(cube->info, face))
+				continue;
+			Cube* adjCube = getAdjacentCube(cube, face);
+			if (!visible(adjCube->info) && (marks[adjCube - m_Cubes] != BREACHED))
+			{
+				marks[adjCube - m_Cubes] = BREACHED;
+				breached.push_back(adjCube);
+			}
+		}
+	}
+
+	// Open up the breached regions: their exposed faces are dropped and the faces of the remaining neighbors exposed
+	it = breached.begin();
+	while (it != breached.end())
+	{
+		Cube* cube = *it++;
+		int face = NUMFACES;
+		while (face--)
+		{
+			if (isExposed(cube->info, face))
+				removeFace(genKey(cube, face));
+			else
+			{
+				Cube* adjCube = getAdjacentCube(cube, face);
+				if (visible(adjCube->info) && !isExposed(adjCube->info, opFace(face)))
+					addFace(adjCube, opFace(face));
+			}
+		}
+	}
+
+	it = tbrCubes.begin();
+	while (it != tbrCubes.end())
+		deleteCube(*it++);
+
+	std::string message = format("Correlated pores: Removed %lld cubes\n", (Dim_t)tbrCubes.size());
+	sendMessage(message);
+
+	return((Dim_t)tbrCubes.size());
+}
+
+void MultiCube::resetExpectedVolume(Dim_t expectedVolume)
+{
+	std::string message;
+
+	Dim_t surfaceArea;
+	Dim_t volume = getVolume(&surfaceArea);
+
+	// Replace any missing cubes caused by porosity and fragmentation
+	int missingCubes = (int)(expectedVolume - volume);
+	if (missingCubes)
+	{
+		replaceCubes(missingCubes);
+		
+		//detectFragments(true);	// Fragmentation Verification (Must return 1 - If not something went wrong)
+
+		volume = getVolume(&surfaceArea);
+		message = format("After Replacing %d Cubes - %lld Total Cubes - %lld exposed faces\n", missingCubes, volume, surfaceArea);
+		sendMessage(message);
+	}
+
+#ifdef WANT_FRAGMENTATION
+	if (!m_params.enableFrag)
+		releaseLabels();	// No longer needed
+#endif //#ifdef WANT_FRAGMENTATION
+}
+
+// Reinserts cubes that were removed due to fragmentation or porosity
+// This is necessary when consistent/reproducable starting volumes are important
+// Note: We prevent the replacement of cubes on original surface faces. 
+// i.e. the shape will never exceed its original boundaries.
+void MultiCube::replaceCubes(int nCubes, bool excludeSurface/*=true*/)
+{
+	std::string message = format("Replacing %d cubes\n", nCubes);
+	sendMessage(message);
+
+	int origExposedFaces = (int)exposedList.size();		// Number of exposed faces originally available.
+	while (nCubes--)
+	{
+		int exposedFaces = (int)exposedList.size();		// Number of exposed faces currently available.
+		Key_t key;
 		// We don't replace cubes adjacent to surface faces.
 		// This would exceed the object's boundary
 		int watchdog_count = 0;
@@ -1042,18 +1858,21 @@ int MultiCube::getPoreSize(Dim_t cubesToRemove)
 }
 
 #ifdef RANDOM_REMOVAL
-void MultiCube::naiveRemoveCube()
+// Returns the cube removed (NULL if nothing was removed)
+Cube* MultiCube::naiveRemoveCube()
 {
 	// Select a random location for the pore to be removed
 	Dim_t index = (Dim_t)(xrand()*cubeList.size());
 	Cube* cube = cubeList[index];
 	if (!visible(cube->info))
-		return;	// Cube already removed. Nothing to do
+		return(NULL);	// Cube already removed. Nothing to do
 
 	if (!hasExposed(cube->info))
 		deleteCube(cube);	// Not on exposed list; do a simple delete
 	else
 		removeCube(cube);	// Remove the cube
+
+	return(cube);
 }
 #endif //#ifdef RANDOM_REMOVAL
 
@@ -1066,15 +1885,22 @@ bool MultiCube::producePores(double& threshhold, int* progress)
 	Dim_t cubesToRemove = (Dim_t)round(m_initialVolume * m_params.porosity);
 	int poreSize = getPoreSize(cubesToRemove);	// Get initial pore dimensions
 	m_cubesRemoved = m_initialVolume - (Dim_t)cubeList.size();
+	if (m_params.trackVoids && !m_voids.active())
+		startVoidTracking();
 	while ((m_cubesRemoved < cubesToRemove) && !testDone())
 	{
-		// Select a random location for the pore to be removed
-		Dim_t index = (Dim_t)(xrand()*cubeList.size());
-		// Get pore dimensions if poresize can vary
-		if (!m_params.poreIsFixed)
-			poreSize = getPoreSize(cubesToRemove);
-		// Remove the pore
-		removePore(cubeList[index], poreSize);
+		if (m_params.poreModel != PORE_RANDOM)
+			generateCorrelatedPores(cubesToRemove - m_cubesRemoved);	// All the pores are produced in a single step
+		else
+		{
+			// Select a random location for the pore to be removed
+			Dim_t index = (Dim_t)(xrand()*cubeList.size());
+			// Get pore dimensions if poresize can vary
+			if (!m_params.poreIsFixed)
+				poreSize = getPoreSize(cubesToRemove);
+			// Remove the pore
+			removePore(cubeList[index], poreSize);
+		}
 		m_cubesRemoved = m_initialVolume - (Dim_t)cubeList.size();
 		double ratio_removed = (double)m_cubesRemoved / (double)cubesToRemove;
 		if (ratio_removed >= threshhold)
@@ -1106,6 +1932,10 @@ bool MultiCube::producePores(double& threshhold, int* progress)
 	// Remove any fragments that might have been created during the porosity phase
 	detectFragments(true);
 	int fragmentCubesRemoved = discardFragments();
+#ifdef WANT_FRAGMENTATION
+	if (!m_params.enableFrag)
+#endif //#ifdef WANT_FRAGMENTATION
+		std::vector<uint32_t>().swap(m_fragIds);	// Only needed for this detection (non-fragmentation runs don't keep them)
 	if (fragmentCubesRemoved)
 	{
 		volume = getVolume(&surfaceArea);
@@ -1158,46 +1988,39 @@ void MultiCube::finishPores()
 #endif //#ifdef USE_CUBE_MAP
 		}
 		fragments.clear();
-		if (m_in_labels)
-			delete[] m_in_labels;
-		m_in_labels = NULL;
-		if (m_out_labels)
-			delete[] m_out_labels;
-		m_out_labels = NULL;
+		releaseLabels();
 	}
+	m_poreTemplates.clear();
 	m_cubesRemoved = 0;	// Reset for normal consuming
 }
 
 // This routine initializes the fragmentation detection routines (the labelling library)
-// Each cube present in the current shape is set to "true" in the label space.
+// Each cube present in the current shape sets its bit in the occupancy grid.
+// The grid is only cleared when allocated. assignFragmentIds() clears the words it used after labelling.
 void MultiCube::initLabels()
 {
-	if (m_in_labels == NULL)
-		m_in_labels = new bool[m_gridSize]();
-	else
-		memset((void*)m_in_labels, 0, m_gridSize * sizeof(bool));
-
-	if (m_out_labels == NULL)
-		m_out_labels = new uint32_t[m_gridSize]();
-	else
-		memset((void*)m_out_labels, 0, m_gridSize * sizeof(uint32_t));
+	if (m_occupancy.empty())
+		m_occupancy.assign((m_gridSize + 63) / 64, 0);
 
 	CubePtrs::iterator it = cubeList.begin();
 	while (it != cubeList.end())
 	{
 		Cube* cube = *it++;
-		m_in_labels[getOffset(cube)] = true;
+		Dim_t offset = getOffset(cube);
+		m_occupancy[offset >> 6] |= 1ULL << (offset & 63);
 	}
 }
 
-void MultiCube::assignFragmentIds(bool init)
+// Frees the labeller input and scratch space
+void MultiCube::releaseLabels()
 {
-	// Initialize the label state for all cubes on the Cube List
-	initLabels();
+	std::vector<uint64_t>().swap(m_occupancy);
+	m_labelBuffers.clear();
+}
 
-	// Run the labeller (all cubes in the label space are checked for connectivity)
-	// The labeller assigns an id number to each item in the label space indicating which component/fragment it belongs to.
-	size_t n_labels = 0;
+// Labeller connectivity for the fragmentAt setting
+int64_t MultiCube::fragmentConnectivity()
+{
 	int64_t connectivity = 6;	// Default is faces
 #ifdef WANT_FRAGMENTATION
 	switch (m_params.fragmentAt) {
@@ -1206,53 +2029,160 @@ void MultiCube::assignFragmentIds(bool init)
 		case 2 : connectivity = 26; break;	// Verts
 	}
 #endif //#ifdef WANT_FRAGMENTATION
-	cc3d::connected_components3d<bool>(m_in_labels, m_params.xdim, m_params.ydim, m_params.zdim, MAXFRAGS, connectivity, m_out_labels, n_labels);
+	return(connectivity);
+}
+
+void MultiCube::assignFragmentIds(bool init)
+{
+	// Run the labeller (all cubes in the label space are checked for connectivity)
+	// The labeller assigns an id number to each item in the label space indicating which component/fragment it belongs to.
+	size_t n_labels = 0;
+	int64_t connectivity = fragmentConnectivity();
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+	int64_t nCubes = (int64_t)cubeList.size();
+	m_cubeLabels.resize(nCubes);
+	if (nCubes * RUN_LABEL_DENSITY < (int64_t)m_gridSize)
+	{	// Mostly empty grid. Label the runs of cubes straight from the cube list.
+		std::vector<uint64_t> offsets(nCubes);
+		parallelFor(nCubes, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+		{
+			for (int64_t i = begin; i < end; i++)
+				offsets[i] = getOffset(cubeList[i]);
+		});
+		n_labels = labelRuns(offsets.data(), nCubes, m_params.xdim, m_params.ydim, m_params.zdim, connectivity, nThreads, m_cubeLabels.data());
+	}
+	else
+	{
+		// Initialize the label state for all cubes on the Cube List
+		initLabels();
+		std::vector<uint32_t> cellLabels;	// Labels of the occupied cells in raster order
+		n_labels = labelOccupancy(m_occupancy.data(), m_params.xdim, m_params.ydim, m_params.zdim, MAXFRAGS, connectivity, nThreads, m_labelBuffers, cellLabels);
+		parallelFor(nCubes, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+		{
+			for (int64_t i = begin; i < end; i++)
+				m_cubeLabels[i] = cellLabels[m_labelBuffers.rank(m_occupancy.data(), getOffset(cubeList[i]))];
+		});
+
+		// Leave the occupancy grid cleared for the next detection
+		CubePtrs::iterator it = cubeList.begin();
+		while (it != cubeList.end())
+			m_occupancy[getOffset(*it++) >> 6] = 0;
+	}
 
 	fragmentSizes.assign(n_labels + 1, 0);
 	fragments.clear();	// Clear any old fragments
+	if (m_fragIds.empty())
+		m_fragIds.assign(m_gridSize, UNINITIALIZED);	// Detection without the fragmentation option (see preprocess())
+#ifdef WANT_FRAGMENTATION
+	if (m_params.animateFrags && m_prevFragIds.empty())
+		m_prevFragIds.assign(m_gridSize, UNINITIALIZED);
+#endif //#ifdef WANT_FRAGMENTATION
+#ifdef WANT_FRAGMENTATION
+	m_fragStats.reset(0);
+#endif //#ifdef WANT_FRAGMENTATION
 
+#ifdef WANT_FRAGMENTATION
+	bool track = m_params.trackFrags && !init;	// Match the new fragments to the previous detection's
+	if ((n_labels == 1) && !useIncrementalFragments() && !track)
+#else
 	if (n_labels == 1)
+#endif //#ifdef WANT_FRAGMENTATION
 		return;			// No fragmentation detected (i.e. everything is part of one object)
 
-	// Once the labelling is complete, collect all cubes
-	// with the same id and store them in a vector.
-	// Each vector will then contain all the cubes of a fragment
-	CubePtrs::iterator it = cubeList.begin();
-	while (it != cubeList.end())
+	bool collect = true;
+#ifdef WANT_FRAGMENTATION
+	collect = init || m_params.outputSaveFrags || m_params.discardFrags || m_params.animateFrags || m_params.histFrags || useDetachedFragments();
+	if (collect)
+		m_fragStats.reset((uint32_t)n_labels);
+#endif //#ifdef WANT_FRAGMENTATION
+
+	// Once the labelling is complete, set the fragment id of every cube
+	// and gather the size, extent and exposure of each fragment
+	for (int64_t i = 0; i < nCubes; i++)
 	{
-		Cube* cube = *it++;
-		Dim_t offset = getOffset(cube);
+		Cube* cube = cubeList[i];
 #ifdef WANT_FRAGMENTATION
 		if (m_params.animateFrags)
-			cube->fragId = getFragmentId(cube->info);	// Previous fragment Id
+			m_prevFragIds[getOffset(cube)] = getFragmentId(cube);	// Previous fragment Id
 #endif //#ifdef WANT_FRAGMENTATION
-		uint32_t fragment = m_out_labels[offset];
+		uint32_t fragment = m_cubeLabels[i];
 		++fragmentSizes[fragment];
-		cube->info = ((Info_t)fragment << FRAGMENT_ID_SHIFT) | (cube->info & ~FRAGMENTMASK);
+#ifdef WANT_FRAGMENTATION
+		if (track)
+			m_fragTracker.addOverlap(getFragmentId(cube), fragment);
+#endif //#ifdef WANT_FRAGMENTATION
+		setFragmentId(cube, fragment);
+#ifdef WANT_FRAGMENTATION
+		if (collect)
+		{
+			int x, y, z;
+			id2pos(cube, x, y, z);
+			m_fragStats.add(fragment, x, y, z, exposedFaceCount(cube));
+		}
+#endif //#ifdef WANT_FRAGMENTATION
+	}
 
 #ifdef WANT_FRAGMENTATION
-		if (init || m_params.outputSaveFrags || m_params.discardFrags || m_params.animateFrags || m_params.histFrags)
+	if (track)
+		m_fragTracker.match(fragmentSizes, m_cubesRemoved);
 #endif //#ifdef WANT_FRAGMENTATION
+
+	// Group the cubes of each fragment (for culling and output)
+	if (collect)
+		buildFragmentTable(m_cubeLabels.data(), (uint32_t)n_labels);
+}
+
+// Groups the cubes on the cube list by label (labels[i] is the label of cubeList[i], 1..nLabels).
+// Counting sort in two parallel passes over chunks of the cube list: count the labels of each chunk,
+// then scatter each chunk's cubes to its own slots so the cube list order is kept within a fragment.
+void MultiCube::buildFragmentTable(const uint32_t* labels, uint32_t nLabels)
+{
+	int64_t nCubes = (int64_t)cubeList.size();
+	int64_t nChunks = nCubes / BULK_INSERT_MIN;	// Keeps the per chunk counts small relative to the work
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+	if (nChunks > (int64_t)nThreads)
+		nChunks = nThreads;
+	if (nChunks < 1)
+		nChunks = 1;
+
+	std::vector<std::vector<Dim_t>> chunkSlots(nChunks, std::vector<Dim_t>(nLabels + 1, 0));
+	parallelFor(nCubes, (unsigned int)nChunks, [&](int64_t begin, int64_t end, unsigned int chunk)
+	{
+		std::vector<Dim_t>& counts = chunkSlots[chunk];
+		for (int64_t i = begin; i < end; i++)
+			++counts[labels[i]];
+	});
+
+	// Prefix sum over (label, chunk) turns the counts into each chunk's first slot for each label
+	fragments.start.assign(nLabels + 2, 0);
+	fragments.nFragments = 0;
+	Dim_t slot = 0;
+	for (uint32_t label = 0; label <= nLabels; label++)
+	{
+		fragments.start[label] = slot;
+		for (int64_t chunk = 0; chunk < nChunks; chunk++)
 		{
-			VectorMap::iterator fit = fragments.find(fragment);
-			if (fit == fragments.end())
-			{		// Create a new fragment vector
-				CubePtrs cubeVect;
-				cubeVect.push_back(cube);
-				fragments[fragment] = cubeVect;
-			}
-			else
-			{		// Add cube to existing fragment vector
-				CubePtrs& cubeVect = fit->second;
-				cubeVect.push_back(cube);
-			}
+			Dim_t count = chunkSlots[chunk][label];
+			chunkSlots[chunk][label] = slot;
+			slot += count;
 		}
+		if (slot != fragments.start[label])
+			++fragments.nFragments;
 	}
+	fragments.start[nLabels + 1] = slot;
+
+	fragments.cubes.resize(nCubes);
+	parallelFor(nCubes, (unsigned int)nChunks, [&](int64_t begin, int64_t end, unsigned int chunk)
+	{
+		std::vector<Dim_t>& slots = chunkSlots[chunk];
+		for (int64_t i = begin; i < end; i++)
+			fragments.cubes[slots[labels[i]]++] = cubeList[i];
+	});
 }
 
 // Wraps the Connected Component 3d library (cc3d.hpp).
-// 1) load cubes in cube list (all active cubes) into cc3d label array
-// 2) run the cc3d labeller - labels each fragment detected with a fragment label
+// 1) load cubes in cube list (all active cubes) into cc3d label array (or into x-runs when the grid is mostly empty)
+// 2) run the cc3d labeller (z-slabs in parallel, see labelComponents()) or the run labeller (labelRuns()) - labels each fragment detected with a fragment label
 // 3) scan the newly labelled fragments to set the cube fragment id
 // 4) compute the size of each fragment for display
 // 5) collect cubes of each distinct fragment into their own vector (for culling and output)
@@ -1264,6 +2194,11 @@ int MultiCube::detectFragments(bool init/*= false*/)
 	memset(&m_lastFragInfo, 0, sizeof(m_lastFragInfo));
 #endif //#ifdef WANT_FRAGMENTATION
 	
+#ifdef WANT_FRAGMENTATION
+	if (m_fragsSeeded)
+		collectFragments(init);	// The ids are already up to date
+	else
+#endif //#ifdef WANT_FRAGMENTATION
 		// Assign the label to the cube's fragment ID
 	assignFragmentIds(init);
 
@@ -1276,6 +2211,18 @@ int MultiCube::detectFragments(bool init/*= false*/)
 		// Run flow simulator on fragments
 		if (m_params.animateFrags)
 			flow_simulator();
+
+		m_detachReady = useDetachedFragments() && m_detachedSteps.empty() && (fragments.size() > 1);
+		if (m_detachReady && fragmentsSharePores())
+		{
+			m_detachReady = false;	// Try again at the next detection
+			if (!m_detachDeferred)
+			{
+				std::string message = format("Detach deferred: fragments share enclosed pores\n");
+				sendMessage(message);
+				m_detachDeferred = true;
+			}
+		}
 	}
 #endif //#ifdef WANT_FRAGMENTATION
 
@@ -1297,67 +2244,210 @@ int MultiCube::detectFragments(bool init/*= false*/)
 		sendMessage(message);
 	}
 */
+#ifdef WANT_FRAGMENTATION
+	if (m_fragsSeeded)
+		return(m_liveFragments + 1);	// Same count as the labeller returns (fragments + background)
+#endif //#ifdef WANT_FRAGMENTATION
 	return(fragmentSizes.empty() ? (int)fragments.size() : (int)fragmentSizes.size());
 }
 
-// Used by sort routine to order the list of fragments from largest to smallest
-bool fragmentCompare(CubePtrs* frag0, CubePtrs* frag1)
+// Sort the list of fragment ids from largest to smallest fragment (equal sizes stay in id order)
+void MultiCube::sortFragments(std::vector<uint32_t>& fragmentList)
 {
-	return (frag0->size() > frag1->size());
-}
-
-// Sort the list of fragments from largest to smallest
-void MultiCube::sortFragments(std::vector<CubePtrs*>& fragmentList)
-{
-	VectorMap::iterator it = fragments.begin();
-	while (it != fragments.end())
+	for (uint32_t fragment = 0; fragment < fragments.labels(); fragment++)
 	{
-		fragmentList.push_back(&(it->second));
-		++it;
+		if (fragments.count(fragment))
+			fragmentList.push_back(fragment);
 	}
 
-	std::sort(fragmentList.begin(), fragmentList.end(), fragmentCompare);
+	std::stable_sort(fragmentList.begin(), fragmentList.end(), [&](uint32_t frag0, uint32_t frag1) { return(fragments.count(frag0) > fragments.count(frag1)); });
 }
 
 // Remove all but largest fragment
+// The discarded cubes are excised in bulk: they're marked on the occupancy bits first (along with any enclosed pores
+// they open up) so only the faces between them and the kept cubes need updating. Their entries on the exposed face
+// and cube lists are then filled from the tail of the lists in one pass (see compactExposedList()/compactCubeList()).
 int MultiCube::discardFragments()
 {
 	if (fragments.size() <= 1)
 		return(0);	// Nothing to do (all cubes are part of one fragment)
 
-	int totalCubesRemoved = 0;
 	//	std::string message = format("%d Fragments discarded\n", (int)fragments.size()-1);
 	//	sendMessage(message);
 
-	std::vector<CubePtrs*> fragmentList;
-
-	sortFragments(fragmentList);
+	// The primary fragment is the largest (the first of equal sizes)
+	uint32_t primary = 0;
+	for (uint32_t fragment = 1; fragment < fragments.labels(); fragment++)
+	{
+		if (fragments.count(fragment) > fragments.count(primary))
+			primary = fragment;
+	}
 
-	std::vector<CubePtrs*>::iterator it = fragmentList.begin();
-	if (it != fragmentList.end())
-		++it;	// Skip over primary fragment (it's the first after the sort)
+	if (m_occupancy.empty())
+		m_occupancy.assign((m_gridSize + 63) / 64, 0);
+	uint64_t* discarded = m_occupancy.data();
 
-		// Remove all the other fragment's cubes
-	while (it != fragmentList.end())
+	// Mark the cubes of all the other fragments
+	CubePtrs tbrCubes;	// To be removed cubes
+	tbrCubes.reserve(fragments.cubes.size() - fragments.count(primary));
+	for (uint32_t fragment = 0; fragment < fragments.labels(); fragment++)
 	{
-		CubePtrs* cubeVec = *it++;
-		CubePtrs::iterator cit = cubeVec->begin();
-		totalCubesRemoved += (int)cubeVec->size();
-		while (cit != cubeVec->end())
+		if ((fragment == primary) || (fragments.count(fragment) == 0))
+			continue;
+#ifdef WANT_FRAGMENTATION
+		if (m_fragsSeeded)
+		{
+			fragmentSizes[fragment] = 0;
+			releaseFragmentId(fragment);
+		}
+#endif //#ifdef WANT_FRAGMENTATION
+		Cube** cit = fragments.begin(fragment);
+		while (cit != fragments.end(fragment))
 		{
 			Cube* cube = *cit++;
-			if (hasExposed(cube->info))		// This cube's faces got exposed during removal. Need to remove it properly.
-				removeCube(cube);
+			Dim_t offset = getOffset(cube);
+			discarded[offset >> 6] |= 1ULL << (offset & 63);
+			tbrCubes.push_back(cube);
+		}
+	}
+	size_t totalCubesRemoved = tbrCubes.size();
+
+	// Hidden faces lead to other discarded cubes or to enclosed pores (only when porosity is enabled).
+	// The pores are opened up just as removeCube() would and any kept cube they touch gets an exposed face.
+	for (size_t cubeIndex = 0; cubeIndex < tbrCubes.size(); cubeIndex++)
+	{
+		Cube* cube = tbrCubes[cubeIndex];
+		int face = NUMFACES;
+		while (face--)
+		{
+			if (isExposed(cube->info, face))
+				continue;
+			Cube* adjCube = getAdjacentCube(cube, face);
+			Dim_t offset = getOffset(adjCube);
+			if (discarded[offset >> 6] & (1ULL << (offset & 63)))
+				continue;	// Removed along with this cube
+			if (!visible(adjCube->info))
+			{	// Pore. Remove it too.
+				setFaceBit(adjCube->info, opFace(face));
+				discarded[offset >> 6] |= 1ULL << (offset & 63);
+				tbrCubes.push_back(adjCube);
+			}
 			else
-				deleteCube(cube);
+				addFace(adjCube, opFace(face));
 		}
 	}
 
-	fragmentList.clear();
+	// Drop the exposed faces and cube list entries of the discarded cubes (pores have neither)
+	std::vector<Dim_t> faceHoles;
+	std::vector<Dim_t> cubeHoles;
+	for (size_t cubeIndex = 0; cubeIndex < tbrCubes.size(); cubeIndex++)
+	{
+		Cube* cube = tbrCubes[cubeIndex];
+		if (cubeIndex < totalCubesRemoved)
+		{
+			int face = NUMFACES;
+			while (face--)
+			{
+				if (!isExposed(cube->info, face))
+					continue;
+				CubeMap::iterator it = exposedMap.find(genKey(cube, face));
+				if (it == exposedMap.end())
+					continue;
+				faceHoles.push_back(it->second);
+				if (m_faceAges.active())
+					m_faceAges.retire(m_cubesRemoved - exposedSince[it->second]);
+				exposedMap.erase(it);
+			}
+			if (!cubeList.empty())
+			{
+#ifdef USE_CUBE_MAP
+				CubePtrsMap::iterator cit = cubeMap.find(cube);
+				if (cit != cubeMap.end())
+				{
+					cubeHoles.push_back(cit->second);
+					cubeMap.erase(cit);
+				}
+#else
+				Dim_t& index = cubeListIndex[getOffset(cube)];
+				if (index != REMOVED)
+				{
+					cubeHoles.push_back(index);
+					index = REMOVED;
+				}
+#endif //#ifdef USE_CUBE_MAP
+			}
+		}
+		markRemoved(cube);
+
+		Dim_t offset = getOffset(cube);
+		discarded[offset >> 6] = 0;	// Leave the occupancy bits cleared
+	}
+	compactExposedList(faceHoles);
+	compactCubeList(cubeHoles);
 
 	m_cubesRemoved += totalCubesRemoved;
 
-	return(totalCubesRemoved);
+	return((int)totalCubesRemoved);
+}
+
+// Removes the entries at the given indices from the exposed face list (their keys are already off the map).
+// Each hole below the new size is filled with a kept entry from the tail, so only the moved entries are re-indexed.
+void MultiCube::compactExposedList(std::vector<Dim_t>& holes)
+{
+	if (holes.empty())
+		return;
+	std::sort(holes.begin(), holes.end());
+
+#ifdef HAS_WXWIDGETS
+#ifdef NEED_THREAD_PROTECTION
+	PortCriticalSection::AutoLock autolock(m_listProtect);	// Protect the list from display thread
+#endif
+#endif //#ifdef HAS_WXWIDGETS
+	Dim_t newSize = exposedList.size() - holes.size();
+	Dim_t tail = exposedList.size();
+	std::vector<Dim_t>::iterator it = holes.begin();
+	while ((it != holes.end()) && (*it < newSize))
+	{
+		Dim_t hole = *it++;
+		do {
+			--tail;
+		} while (!visible(getCube(exposedList[tail])->info));	// Skip the holes in the tail
+		Key_t key = exposedList[tail];
+		exposedList[hole] = key;
+		exposedMap[key] = hole;
+		if (m_faceAges.active())
+			exposedSince[hole] = exposedSince[tail];
+	}
+	exposedList.resize(newSize);
+	if (m_faceAges.active())
+		exposedSince.resize(newSize);
+}
+
+// Removes the entries at the given indices from the cube list (their index entries are already cleared).
+void MultiCube::compactCubeList(std::vector<Dim_t>& holes)
+{
+	if (holes.empty())
+		return;
+	std::sort(holes.begin(), holes.end());
+
+	Dim_t newSize = cubeList.size() - holes.size();
+	Dim_t tail = cubeList.size();
+	std::vector<Dim_t>::iterator it = holes.begin();
+	while ((it != holes.end()) && (*it < newSize))
+	{
+		Dim_t hole = *it++;
+		do {
+			--tail;
+		} while (!visible(cubeList[tail]->info));	// Skip the holes in the tail
+		Cube* cube = cubeList[tail];
+		cubeList[hole] = cube;
+#ifdef USE_CUBE_MAP
+		cubeMap[cube] = hole;
+#else
+		cubeListIndex[getOffset(cube)] = hole;
+#endif //#ifdef USE_CUBE_MAP
+	}
+	cubeList.resize(newSize);
 }
 
 #ifdef WANT_FRAGMENTATION
@@ -1376,34 +2466,12 @@ bool AABBtoAABB(Fragment& tBox1, Fragment& tBox2)
 	//If not, it will return false
 }
 
-Fragment MultiCube::getBoundingBox(CubePtrs& cubeVec, Fragment* prevFrag)
+Fragment MultiCube::getBoundingBox(uint32_t fragment, Fragment* prevFrag)
 {
-	CubePtrs::iterator cit = cubeVec.begin();
-	Cube* cube = *cit++;
-	int minX, minY, minZ;
-	id2pos(cube, minX, minY, minZ);
-	int maxX = minX;
-	int maxY = minY;
-	int maxZ = minZ;
-	while (cit != cubeVec.end())
-	{
-		Cube* cube = *cit++;
-		int x, y, z;
-		id2pos(cube, x, y, z);
-		if (x < minX)
-			minX = x;
-		else if (x > maxX)
-			maxX = x;
-		if (y < minY)
-			minY = y;
-		else if (y > maxY)
-			maxY = y;
-		if (z < minZ)
-			minZ = z;
-		else if (z > maxZ)
-			maxZ = z;
-	}
-	
+	int minX = m_fragStats.minX[fragment], maxX = m_fragStats.maxX[fragment];
+	int minY = m_fragStats.minY[fragment], maxY = m_fragStats.maxY[fragment];
+	int minZ = m_fragStats.minZ[fragment], maxZ = m_fragStats.maxZ[fragment];
+
 	Fragment fragInfo;
 
 		// Set Centroid
@@ -1463,28 +2531,25 @@ void MultiCube::flow_simulator()
 		FragmentMap newFragMap;
 
 			// Get the biggest fragment (it won't move)
-		VectorMap::iterator it = fragments.begin();
 		int maxFragSize = 0;
 		Fragment biggestFrag;
 		int biggestFragId = 0;
-		while (it != fragments.end())
+		for (uint32_t fragment = 0; fragment < fragments.labels(); fragment++)
 		{
-			CubePtrs& cubeVec = it->second;
-			++it;
-
-			int fragSize = (int)cubeVec.size();
+			int fragSize = (int)fragments.count(fragment);
 			if (fragSize > maxFragSize)
 			{
-				Cube* cube = cubeVec[0];
+				Cube* cube = *fragments.begin(fragment);
 				Fragment* prevFrag = NULL;
-				if (cube->fragId != 0)
+				uint32_t prevId = m_prevFragIds[getOffset(cube)];
+				if (prevId != UNINITIALIZED)
 				{
-					FragmentMap::iterator fit = fragMap.find(cube->fragId);
+					FragmentMap::iterator fit = fragMap.find(prevId);
 					if (fit != fragMap.end())
 						prevFrag = &fit->second;
 				}
-				biggestFragId = getFragmentId(cube->info);
-				biggestFrag = getBoundingBox(cubeVec, prevFrag);
+				biggestFragId = getFragmentId(cube);
+				biggestFrag = getBoundingBox(fragment, prevFrag);
 				maxFragSize = fragSize;
 			}
 		}
@@ -1495,27 +2560,26 @@ void MultiCube::flow_simulator()
 		}
 
 			// Map the small fragments
-		it = fragments.begin();
-		while (it != fragments.end())
+		for (uint32_t fragment = 0; fragment < fragments.labels(); fragment++)
 		{
-			CubePtrs& cubeVec = it->second;
-			++it;
-
-			int fragSize = (int)cubeVec.size();
+			int fragSize = (int)fragments.count(fragment);
+			if (fragSize == 0)
+				continue;
 			if ((fragSize >= maxFragSize) && doCollisionDetect)
 				continue;
 
-			Cube* cube = cubeVec[0];
-			uint32_t fragmentId = getFragmentId(cube->info);
+			Cube* cube = *fragments.begin(fragment);
+			uint32_t fragmentId = getFragmentId(cube);
 			Fragment* prevFrag = NULL;
-			if (cube->fragId != 0)
+			uint32_t prevId = m_prevFragIds[getOffset(cube)];
+			if (prevId != UNINITIALIZED)
 			{
-				FragmentMap::iterator fit = fragMap.find(cube->fragId);
+				FragmentMap::iterator fit = fragMap.find(prevId);
 				if (fit != fragMap.end())
 					prevFrag = &fit->second;
 			}
 
-			Fragment fragInfo = getBoundingBox(cubeVec, prevFrag);
+			Fragment fragInfo = getBoundingBox(fragment, prevFrag);
 
 			double index = log10((double)fragSize);
 			if (index > MAX_COLOR_INDEX)
@@ -1534,42 +2598,490 @@ void MultiCube::flow_simulator()
 			double yadjust = 0.02 * yscale;
 			double zadjust = (index / 5.0) * zscale;
 
-			bool collision = false;
-			if (doCollisionDetect)
-				collision = AABBtoAABB(fragInfo, biggestFrag);
+			bool collision = false;
+			if (doCollisionDetect)
+				collision = AABBtoAABB(fragInfo, biggestFrag);
+
+			fragInfo.x += xadjust;
+			fragInfo.y += yadjust;
+			if (!collision)
+			{
+				fragInfo.z += zadjust;
+			}
+			else
+			{	fragInfo.x += xadjust*1;
+				fragInfo.y += yadjust*1;
+				fragInfo.z += zadjust*0.2;
+			}
+
+			newFragMap[fragmentId] = fragInfo;
+		}
+#ifdef NEED_THREAD_PROTECTION
+		PortCriticalSection::AutoLock autolock(m_fragProtect);	// Protect the fragment map from display thread
+#endif
+		fragMap = newFragMap;
+	}
+}
+
+// Incremental tracking replaces the per increment relabelling when requested.
+// (Fragment animation relies on the relabelling so it always uses the full labeller)
+bool MultiCube::useIncrementalFragments()
+{
+	return(m_params.enableFrag && m_params.incrementalFrag && !m_params.animateFrags && !m_params.trackFrags);
+}
+
+// Label every cube once with the full labeller. From here on the ids are maintained by updateFragments().
+void MultiCube::seedFragments()
+{
+	assignFragmentIds(true);
+
+	m_freeFragIds.clear();
+	m_liveFragments = 0;
+	for (size_t fragmentId = 1; fragmentId < fragmentSizes.size(); fragmentId++)
+	{
+		if (fragmentSizes[fragmentId])
+			++m_liveFragments;
+		else
+			m_freeFragIds.push_back((uint32_t)fragmentId);
+	}
+
+	buildFragmentNeighbors();
+
+	// The labelling space isn't needed again
+	releaseLabels();
+
+	m_fragsSeeded = true;
+}
+
+// Neighbor offsets for the selected connectivity (faces, edges or vertices)
+void MultiCube::buildFragmentNeighbors()
+{
+	int maxNonZero = (m_params.fragmentAt == 0) ? 1 : (m_params.fragmentAt == 1) ? 2 : 3;
+	m_fragNeighbors.clear();
+	for (int dz = -1; dz <= 1; dz++)
+	{
+		for (int dy = -1; dy <= 1; dy++)
+		{
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				int nonZero = (dx != 0) + (dy != 0) + (dz != 0);
+				if ((nonZero == 0) || (nonZero > maxNonZero))
+					continue;
+				m_fragNeighbors.push_back(dx);
+				m_fragNeighbors.push_back(dy);
+				m_fragNeighbors.push_back(dz);
+			}
+		}
+	}
+}
+
+// Collect the visible neighbors of a cube (using the fragment connectivity). Returns the neighbor count.
+int MultiCube::getFragmentNeighbors(Cube* cube, Cube** neighbors)
+{
+	int x, y, z;
+	id2pos(cube, x, y, z);
+
+	int nNeighbors = 0;
+	int nOffsets = (int)m_fragNeighbors.size();
+	for (int i = 0; i < nOffsets; i += 3)
+	{
+		int nx = x + m_fragNeighbors[i];
+		int ny = y + m_fragNeighbors[i + 1];
+		int nz = z + m_fragNeighbors[i + 2];
+		if ((nx < 0) || (ny < 0) || (nz < 0) || (nx >= (int)m_params.xdim) || (ny >= (int)m_params.ydim) || (nz >= (int)m_params.zdim))
+			continue;
+		Cube* adjCube = getCube(nx, ny, nz);
+		if (visible(adjCube->info))
+			neighbors[nNeighbors++] = adjCube;
+	}
+	return(nNeighbors);
+}
+
+uint32_t MultiCube::newFragmentId()
+{
+	++m_liveFragments;
+	if (!m_freeFragIds.empty())
+	{
+		uint32_t fragmentId = m_freeFragIds.back();
+		m_freeFragIds.pop_back();
+		return(fragmentId);
+	}
+
+#ifdef NEED_THREAD_PROTECTION
+	PortCriticalSection::AutoLock autolock(m_fragProtect);	// The display thread reads the fragment sizes
+#endif
+	fragmentSizes.push_back(0);
+	return((uint32_t)fragmentSizes.size() - 1);
+}
+
+void MultiCube::releaseFragmentId(uint32_t fragmentId)
+{
+	--m_liveFragments;
+	m_freeFragIds.push_back(fragmentId);
+}
+
+// Update the fragment ids after a cube has been removed.
+// Only the neighbors of the removed cube can have become disconnected from each other.
+// A search is started from each neighbor and the searches are advanced one cube at a time in turn.
+// Searches that reach each other are grouped. A group whose searches all run out of cubes before
+// reaching the others has split off and is given a new fragment id. The check stops as soon as
+// a single group remains so its cost is bounded by the size of the pieces that split off.
+void MultiCube::updateFragments(Cube* removedCube)
+{
+	if (removedCube == NULL)
+		return;
+
+	uint32_t fragmentId = getFragmentId(removedCube);
+	if ((fragmentId < fragmentSizes.size()) && fragmentSizes[fragmentId])
+	{
+		if (--fragmentSizes[fragmentId] == 0)
+			releaseFragmentId(fragmentId);
+	}
+
+	Cube* neighbors[26];
+	int nSearches = getFragmentNeighbors(removedCube, neighbors);
+	if (nSearches < 2)
+		return;	// Nothing can have split
+
+	int group[26];	// Group (union-find parent) of each search
+	auto findGroup = [&](int search) -> int
+	{
+		while (group[search] != search)
+			search = group[search] = group[group[search]];
+		return(search);
+	};
+
+	if ((int)m_fragSearches.size() < nSearches)
+		m_fragSearches.resize(nSearches);
+	m_fragHeads.assign(nSearches, 0);
+	for (int search = 0; search < nSearches; search++)
+	{
+		m_fragSearches[search].clear();
+		m_fragSearches[search].push_back(neighbors[search]);
+		m_fragVisited[neighbors[search]] = search;
+		group[search] = search;
+	}
+
+	int nGroups = nSearches;
+	bool advanced = true;
+	while ((nGroups > 1) && advanced)
+	{
+		advanced = false;
+		for (int search = 0; (search < nSearches) && (nGroups > 1); search++)
+		{
+			CubePtrs& cubes = m_fragSearches[search];
+			if (m_fragHeads[search] >= cubes.size())
+				continue;	// This search has run out
+
+			advanced = true;
+			Cube* cube = cubes[m_fragHeads[search]++];
+			int nNeighbors = getFragmentNeighbors(cube, neighbors);
+			for (int i = 0; i < nNeighbors; i++)
+			{
+				robin_hood::unordered_flat_map<Cube*, int>::iterator it = m_fragVisited.find(neighbors[i]);
+				if (it == m_fragVisited.end())
+				{
+					m_fragVisited[neighbors[i]] = search;
+					cubes.push_back(neighbors[i]);
+				}
+				else
+				{	// Reached a cube of another search, join the groups
+					int g0 = findGroup(search);
+					int g1 = findGroup(it->second);
+					if (g0 != g1)
+					{
+						group[g1] = g0;
+						--nGroups;
+					}
+				}
+			}
+
+			if ((m_fragHeads[search] < cubes.size()) || (nGroups <= 1))
+				continue;
+
+			// The search has run out. If the rest of its group has too, the group is a separate piece.
+			int g = findGroup(search);
+			bool separated = true;
+			for (int other = 0; (other < nSearches) && separated; other++)
+			{
+				if ((findGroup(other) == g) && (m_fragHeads[other] < m_fragSearches[other].size()))
+					separated = false;
+			}
+			if (!separated)
+				continue;
+
+			uint32_t newId = newFragmentId();
+			uint32_t count = 0;
+			for (int other = 0; other < nSearches; other++)
+			{
+				if (findGroup(other) != g)
+					continue;
+				CubePtrs::iterator cit = m_fragSearches[other].begin();
+				while (cit != m_fragSearches[other].end())
+				{
+					Cube* pieceCube = *cit++;
+					setFragmentId(pieceCube, newId);
+					++count;
+				}
+			}
+			fragmentSizes[newId] = count;
+			fragmentSizes[fragmentId] -= count;
+			--nGroups;
+		}
+	}
+
+	// Forget the visited cubes (cheaper than clearing a map that grew during an earlier large search)
+	for (int search = 0; search < nSearches; search++)
+	{
+		CubePtrs::iterator cit = m_fragSearches[search].begin();
+		while (cit != m_fragSearches[search].end())
+			m_fragVisited.erase(*cit++);
+	}
+}
+
+// Gather the cubes of each fragment from the maintained ids (replaces the labeller when tracking incrementally)
+void MultiCube::collectFragments(bool init)
+{
+	fragments.clear();
+	m_fragStats.reset(0);
+	if (m_liveFragments <= 1)
+		return;			// No fragmentation (i.e. everything is part of one object)
+	if (!(init || m_params.outputSaveFrags || m_params.discardFrags || m_params.histFrags))
+		return;			// Only the count is needed
+
+	// Read back the ids and gather the fragment statistics (each thread into its own table)
+	uint32_t nLabels = (uint32_t)fragmentSizes.size() - 1;
+	int64_t nCubes = (int64_t)cubeList.size();
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+	if ((int64_t)nThreads > nCubes / BULK_INSERT_MIN)
+		nThreads = (unsigned int)std::max(nCubes / BULK_INSERT_MIN, (int64_t)1);
+	std::vector<FragmentStats> threadStats(nThreads);
+	m_cubeLabels.resize(nCubes);
+	parallelFor(nCubes, nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		FragmentStats& stats = threadStats[thread];
+		stats.reset(nLabels);
+		for (int64_t i = begin; i < end; i++)
+		{
+			Cube* cube = cubeList[i];
+			uint32_t fragment = getFragmentId(cube);
+			int x, y, z;
+			id2pos(cube, x, y, z);
+			stats.add(fragment, x, y, z, exposedFaceCount(cube));
+			m_cubeLabels[i] = fragment;
+		}
+	});
+	m_fragStats = std::move(threadStats[0]);
+	for (unsigned int thread = 1; thread < nThreads; thread++)
+		m_fragStats.merge(threadStats[thread]);
+	buildFragmentTable(m_cubeLabels.data(), nLabels);
+}
+
+// Snapshot the cubes present and start logging removals.
+// Connectivity of the solid only decreases from here on so the fragmentation history can be rebuilt afterwards.
+void MultiCube::startTimeline()
+{
+	// From the grid (the cube list is only kept for some runs)
+	m_timelineStart.clear();
+	for (Dim_t offset = 0; offset < m_gridSize; offset++)
+	{
+		if (visible(m_Cubes[offset].info))
+			m_timelineStart.push_back(offset);
+	}
+	m_removalLog.clear();
+	m_removalLog.reserve(m_timelineStart.size());
+	m_recordRemovals = true;
+}
+
+// Rebuilds the exact fragmentation history from the removal log.
+// The removals are replayed backwards as insertions into a union-find so every split is found in near linear time.
+// countFile: "removal,fragments" each time the fragment count changes (removal = cubes removed since the log was started)
+// splitFile: one line per split "removal,parent,size,piece sizes..." in removal order.
+//		size is the fragment size before the removal and parent is the line (0 based) of the split that produced the fragment (-1 = original)
+bool MultiCube::outputFragmentTimeline(char* countFile, char* splitFile)
+{
+	if (!m_recordRemovals)
+		return(false);
+
+	const uint32_t NONE = 0xFFFFFFFF;
+	uint32_t nCubes = (uint32_t)m_timelineStart.size();
+
+	// Solid index of each grid position (NONE if not part of the starting solid)
+	std::vector<uint32_t> solidIndex(m_gridSize, NONE);
+	for (uint32_t i = 0; i < nCubes; i++)
+		solidIndex[m_timelineStart[i]] = i;
+
+	// Removal order (as solid indices). Re-opened pore cubes were never part of the starting solid.
+	std::vector<uint32_t> order;
+	order.reserve(m_removalLog.size());
+	std::vector<char> present(nCubes, 1);
+	std::vector<Dim_t>::iterator it = m_removalLog.begin();
+	while (it != m_removalLog.end())
+	{
+		uint32_t index = solidIndex[*it++];
+		if ((index != NONE) && present[index])
+		{
+			present[index] = 0;
+			order.push_back(index);
+		}
+	}
+
+	buildFragmentNeighbors();
+	int nOffsets = (int)m_fragNeighbors.size();
+
+	UnionFind sets(nCubes);
+	std::vector<uint32_t> lastSplit(nCubes, NONE);	// By root: the earliest split (in removal order) of the set's fragment
+	std::vector<uint32_t> splitParent;
+	std::vector<Dim_t> splitRemoval;
+	std::vector<std::vector<uint64_t>> splitPieces;
+	std::vector<uint32_t> fragmentCount(order.size() + 1);
+	uint32_t nFragments = 0;
+
+	// Inserts a cube and joins it to its present neighbors. Returns the distinct sets it joined.
+	uint32_t roots[26];
+	auto insert = [&](uint32_t index) -> int
+	{
+		Dim_t offset = m_timelineStart[index];
+		int z = (int)(offset / m_layerSize);
+		int y = (int)((offset % m_layerSize) / m_rowSize);
+		int x = (int)(offset % m_rowSize);
+		int nRoots = 0;
+		for (int i = 0; i < nOffsets; i += 3)
+		{
+			int nx = x + m_fragNeighbors[i];
+			int ny = y + m_fragNeighbors[i + 1];
+			int nz = z + m_fragNeighbors[i + 2];
+			if ((nx < 0) || (ny < 0) || (nz < 0) || (nx >= (int)m_params.xdim) || (ny >= (int)m_params.ydim) || (nz >= (int)m_params.zdim))
+				continue;
+			uint32_t adjIndex = solidIndex[getOffset(nx, ny, nz)];
+			if ((adjIndex == NONE) || !present[adjIndex])
+				continue;
+			uint32_t root = sets.find(adjIndex);
+			int r = 0;
+			while ((r < nRoots) && (roots[r] != root))
+				++r;
+			if (r == nRoots)
+				roots[nRoots++] = root;
+		}
+		present[index] = 1;
+		++nFragments;
+		return(nRoots);
+	};
+
+	// Cubes that were never removed (all taken out first so each adjacency is only joined once)
+	std::vector<uint32_t> survivors;
+	for (uint32_t index = 0; index < nCubes; index++)
+	{
+		if (present[index])
+			survivors.push_back(index);
+	}
+	std::fill(present.begin(), present.end(), 0);
+	std::vector<uint32_t>::iterator sit = survivors.begin();
+	while (sit != survivors.end())
+	{
+		uint32_t index = *sit++;
+		int nRoots = insert(index);
+		for (int r = 0; r < nRoots; r++)
+		{
+			sets.unite(index, roots[r]);
+			--nFragments;
+		}
+	}
+	fragmentCount[order.size()] = nFragments;
+
+	// The replay starts from the survivors, so their count must match a fresh labelling
+	{
+		std::vector<uint64_t> offsets(survivors.size());
+		for (size_t i = 0; i < survivors.size(); i++)
+			offsets[i] = m_timelineStart[survivors[i]];
+		std::vector<uint32_t> labels(survivors.size());
+		size_t nLabels = labelRuns(offsets.data(), offsets.size(), m_params.xdim, m_params.ydim, m_params.zdim, fragmentConnectivity(), getThreadCount(m_params.nThreads), labels.data());
+		if (nLabels != nFragments)
+		{
+			std::string message = format("Fragmentation timeline: %d fragments at the last removal but %d labelled\n", nFragments, (int)nLabels);
+			sendMessage(message);
+			return(false);
+		}
+	}
 
-			fragInfo.x += xadjust;
-			fragInfo.y += yadjust;
-			if (!collision)
+	// Replay the removals backwards
+	size_t removal = order.size();
+	while (removal--)
+	{
+		uint32_t index = order[removal];
+		int nRoots = insert(index);
+		uint32_t split = NONE;
+		if (nRoots > 1)
+		{	// Removing this cube split its fragment into the joined sets
+			split = (uint32_t)splitRemoval.size();
+			splitRemoval.push_back(removal + 1);
+			splitParent.push_back(NONE);
+			std::vector<uint64_t> pieces;
+			for (int r = 0; r < nRoots; r++)
 			{
-				fragInfo.z += zadjust;
-			}
-			else
-			{	fragInfo.x += xadjust*1;
-				fragInfo.y += yadjust*1;
-				fragInfo.z += zadjust*0.2;
+				pieces.push_back(sets.size(roots[r]));
+				if (lastSplit[roots[r]] != NONE)
+					splitParent[lastSplit[roots[r]]] = split;
 			}
+			splitPieces.push_back(pieces);
+		}
+		else if (nRoots == 1)
+			split = lastSplit[roots[0]];
 
-			newFragMap[fragmentId] = fragInfo;
+		uint32_t root = index;
+		for (int r = 0; r < nRoots; r++)
+		{
+			root = sets.unite(root, roots[r]);
+			--nFragments;
 		}
-#ifdef NEED_THREAD_PROTECTION
-		PortCriticalSection::AutoLock autolock(m_fragProtect);	// Protect the fragment map from display thread
-#endif
-		fragMap = newFragMap;
+		lastSplit[root] = split;
+		fragmentCount[removal] = nFragments;
+	}
+
+	FILE* fp = fopen(countFile, "w+");
+	if (fp == NULL)
+		return(false);
+	for (size_t i = 0; i < fragmentCount.size(); i++)
+	{
+		if ((i == 0) || (i == fragmentCount.size() - 1) || (fragmentCount[i] != fragmentCount[i - 1]))
+			fprintf(fp, "%lld,%d\n", (Dim_t)i, fragmentCount[i]);
+	}
+	fclose(fp);
+
+	fp = fopen(splitFile, "w+");
+	if (fp == NULL)
+		return(false);
+	uint32_t nSplits = (uint32_t)splitRemoval.size();
+	for (uint32_t i = 0; i < nSplits; i++)
+	{	// Splits were found latest first; write them in removal order
+		uint32_t split = nSplits - 1 - i;
+		uint32_t parent = splitParent[split];
+		std::vector<uint64_t>& pieces = splitPieces[split];
+		uint64_t size = 1;
+		for (size_t p = 0; p < pieces.size(); p++)
+			size += pieces[p];
+		fprintf(fp, "%lld,%d,%lld", splitRemoval[split], (parent == NONE) ? -1 : (int)(nSplits - 1 - parent), (Dim_t)size);
+		for (size_t p = 0; p < pieces.size(); p++)
+			fprintf(fp, ",%lld", (Dim_t)pieces[p]);
+		fprintf(fp, "\n");
 	}
+	fclose(fp);
+
+	std::string message = format("Fragmentation timeline: %d splits over %lld removals\n", nSplits, (Dim_t)order.size());
+	sendMessage(message);
+
+	return(true);
 }
 
 // Build a histogram of fragment sizes. Bin width = log10(size) 
 void MultiCube::getHistogram()
 {
 	int hist[6] = { 0,0,0,0,0,0 };
-	VectorMap::iterator it = fragments.begin();
-	while (it != fragments.end())
+	for (uint32_t fragment = 0; fragment < m_fragStats.labels(); fragment++)
 	{
-		CubePtrs& cubeVec = it->second;
-		++it;
-
-		int fragSize = (int)cubeVec.size();
+		int fragSize = (int)m_fragStats.size[fragment];
+		if (fragSize == 0)
+			continue;
 		int	index = (fragSize > 0.0) ? (int)round(log10(fragSize)) : MAX_COLOR_INDEX;
 		if (index > MAX_COLOR_INDEX)
 			index = MAX_COLOR_INDEX;
@@ -1725,7 +3237,7 @@ int MultiCube::getColorIndexAndPosition(Cube* cube, int& x, int& y, int& z)
 
 	if (!m_params.displayFaces || m_params.animateFrags)
 	{
-		uint32_t fragmentId = getFragmentId(cube->info);
+		uint32_t fragmentId = getFragmentId(cube);
 		Fragment fragInfo = m_lastFragInfo;
 
 		if (fragmentId != m_lastFragmentId)
@@ -1799,41 +3311,338 @@ Dim_t MultiCube::getVolume(Dim_t* surfaceArea/*=NULL*/)
 #ifdef WANT_FRAGMENTATION
 // Output the Fragment Vectors
 void MultiCube::outputFragments(char* filename)
+{
+	m_fragStats.output(filename);
+}
+
+// Fragment ids from largest to smallest fragment (equal sizes stay in id order)
+void FragmentStats::order(std::vector<uint32_t>& ids)
+{
+	for (uint32_t fragment = 1; fragment <= labels(); fragment++)
+	{
+		if (size[fragment])
+			ids.push_back(fragment);
+	}
+
+	std::stable_sort(ids.begin(), ids.end(), [&](uint32_t frag0, uint32_t frag1) { return(size[frag0] > size[frag1]); });
+}
+
+// Writes "size,exposed cubes,exposed faces,cx,cy,cz" for every fragment but the largest
+bool FragmentStats::output(const char* filename)
 {
 	FILE* fp = fopen(filename, "w+");
 	if (fp == NULL)
-		return;
+		return(false);
 
-	std::vector<CubePtrs*> fragmentList;
+	std::vector<uint32_t> fragmentList;
 
-	sortFragments(fragmentList);
+	order(fragmentList);
 
-	std::vector<CubePtrs*>::iterator it = fragmentList.begin();
+	std::vector<uint32_t>::iterator it = fragmentList.begin();
 	if (it != fragmentList.end())
 		++it;	// Skip over 1st fragment (it's the largest after the sort)
 
-		// Remove all the other fragment's cubes
 	while (it != fragmentList.end())
 	{
-		CubePtrs* cubeVec = *it++;
-		int exposedFaces = 0;
-		int exposedCubes = 0;
-		CubePtrs::iterator cit = cubeVec->begin();
-		while (cit != cubeVec->end())
+		uint32_t fragment = *it++;
+		fprintf(fp, "%d,%d,%d,%.2f,%.2f,%.2f\n", (int)size[fragment], (int)exposedCubes[fragment], (int)exposedFaces[fragment],
+			centroidX(fragment), centroidY(fragment), centroidZ(fragment));
+	}
+
+	fclose(fp);
+	return(true);
+}
+
+bool MultiCube::usePipelinedFragments()
+{
+	return(m_params.enableFrag && m_params.pipelineFrags && !m_params.discardFrags && !m_params.animateFrags && !m_params.trackFrags);
+}
+
+// Copies the cube list (grid offset and exposed face count of each cube) and hands it to the pipeline.
+// The copy is the only work done on the consume thread. Blocks while PIPELINE_DEPTH snapshots are waiting.
+void MultiCube::queueFragments(char* filename)
+{
+	if (m_fragPipeline == NULL)
+		m_fragPipeline = new FragmentPipeline(m_params.xdim, m_params.ydim, m_params.zdim, fragmentConnectivity(), getThreadCount(m_params.nThreads));
+
+	int64_t nCubes = (int64_t)cubeList.size();
+	std::vector<uint64_t> cells(nCubes);
+	parallelFor(nCubes, getThreadCount(m_params.nThreads), [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t i = begin; i < end; i++)
 		{
-			Cube* cube = *cit++;
-			int nFaces = exposedFaceCount(cube);
-			if (nFaces)
+			Cube* cube = cubeList[i];
+			cells[i] = ((uint64_t)getOffset(cube) << SNAPSHOT_FACE_BITS) | exposedFaceCount(cube);
+		}
+	});
+	m_fragPipeline->submit(cells, filename);
+}
+
+int MultiCube::pipelinedFragments()
+{
+	return(m_fragPipeline ? m_fragPipeline->fragments() + 1 : 0);	// Same count as detectFragments() returns (fragments + background)
+}
+
+void MultiCube::finishFragments()
+{
+	if (m_fragPipeline)
+		m_fragPipeline->finish();
+}
+
+bool MultiCube::outputFragmentLineage(char* filename)
+{
+	return(m_fragTracker.output(filename));
+}
+
+// Detached fragments are consumed on their own when requested.
+// (The modes that follow every removal on the full grid need the shared process, and the outputs
+// that measure the grid after each increment would find it empty once the fragments are detached)
+bool MultiCube::useDetachedFragments()
+{
+	return(m_params.enableFrag && m_params.detachFrags && !m_params.discardFrags && !m_params.animateFrags && !m_params.incrementalFrag && 
+		!m_params.fragTimeline && !m_params.pipelineFrags && !m_params.trackFrags && !m_params.trackVoids && !m_params.trackEuler && !m_params.trackMoments && !m_params.trackFaceAge &&
+		!m_params.outputSaveFrags && !m_params.outputSaveGrid && !m_params.depthStats && !m_params.hullStats && !m_params.fractalDim && m_params.granuleAt.empty()
+#ifdef RANDOM_REMOVAL
+		&& !m_params.naiveRemoval
+#endif //#ifdef RANDOM_REMOVAL
+	);
+}
+
+// True when an enclosed pore of the last detection can be reached (through hidden faces) from more than one fragment.
+// Opening such a pore exposes faces of every fragment around it, which independent sub-grids can't reproduce,
+// so the fragments aren't detached until the shared pores are gone.
+bool MultiCube::fragmentsSharePores()
+{
+	if (!(m_params.porosity > 0.0))
+		return(false);
+
+	robin_hood::unordered_flat_map<Cube*, uint32_t> owners;	// Fragment that reached each pore
+	CubePtrs pores;
+	for (uint32_t fragment = 0; fragment < fragments.labels(); fragment++)
+	{
+		Cube** cit = fragments.begin(fragment);
+		pores.clear();
+		size_t poreIndex = 0;
+		while ((cit != fragments.end(fragment)) || (poreIndex < pores.size()))
+		{
+			Cube* cube = (cit != fragments.end(fragment)) ? *cit++ : pores[poreIndex++];
+			int face = NUMFACES;
+			while (face--)
+			{
+				if (isExposed(cube->info, face))
+					continue;
+				Cube* adjCube = getAdjacentCube(cube, face);
+				if (visible(adjCube->info))
+				{
+					if (getFragmentId(adjCube) != fragment)
+						return(true);	// A pore touching another fragment
+					continue;
+				}
+				std::pair<robin_hood::unordered_flat_map<Cube*, uint32_t>::iterator, bool> owner = owners.emplace(adjCube, fragment);
+				if (owner.second)
+					pores.push_back(adjCube);
+				else if (owner.first->second != fragment)
+					return(true);		// Reached from another fragment
+			}
+		}
+	}
+	return(false);
+}
+
+// Builds a compact grid holding one fragment of the parent (from the last detection) with its own random stream.
+// The enclosed pores reachable from the fragment come along so pore openings cascade as they would in the parent
+// (no pore is shared with another fragment, see fragmentsSharePores()).
+MultiCube::MultiCube(MultiCube& parent, uint32_t fragment, uint64_t seed) : m_params(parent.m_params), m_doneFlag(parent.m_doneFlag)
+{
+	initMembers();
+	m_rngState = seed;
+
+	m_params.outputSave		= false;
+	m_params.outputSaveGrid	= false;
+	m_params.aggregateEnable= false;
+	m_params.trackVoids		= false;
+	m_params.trackEuler		= false;
+	m_params.trackMoments	= false;
+	m_params.trackFaceAge	= false;
+	m_params.hullStats		= false;
+	m_params.enableFrag		= false;
+	m_params.nThreads		= 1;
+#ifdef HAS_WXWIDGETS
+	m_params.displayEnable	= false;	// Never displayed (no list protection needed)
+#endif //#ifdef HAS_WXWIDGETS
+
+	// Pores reachable through the hidden faces of the fragment (and of the pores themselves)
+	CubePtrs pores;
+	if (m_params.porosity > 0.0)
+	{
+		robin_hood::unordered_flat_set<Cube*> reached;
+		Cube** cit = parent.fragments.begin(fragment);
+		size_t poreIndex = 0;
+		while ((cit != parent.fragments.end(fragment)) || (poreIndex < pores.size()))
+		{
+			Cube* cube = (cit != parent.fragments.end(fragment)) ? *cit++ : pores[poreIndex++];
+			int face = NUMFACES;
+			while (face--)
 			{
-				exposedFaces += nFaces;
-				++exposedCubes;
+				if (isExposed(cube->info, face))
+					continue;
+				Cube* adjCube = parent.getAdjacentCube(cube, face);
+				if (!visible(adjCube->info) && reached.insert(adjCube).second)
+					pores.push_back(adjCube);
 			}
 		}
-		int numCubes = (int)cubeVec->size();
-		fprintf(fp, "%d,%d,%d\n", numCubes, exposedCubes, exposedFaces);
 	}
 
-	fclose(fp);
+	int minX = parent.m_fragStats.minX[fragment], maxX = parent.m_fragStats.maxX[fragment];
+	int minY = parent.m_fragStats.minY[fragment], maxY = parent.m_fragStats.maxY[fragment];
+	int minZ = parent.m_fragStats.minZ[fragment], maxZ = parent.m_fragStats.maxZ[fragment];
+	CubePtrs::iterator pit = pores.begin();
+	while (pit != pores.end())
+	{
+		int x, y, z;
+		parent.id2pos(*pit++, x, y, z);
+		minX = std::min(minX, x); maxX = std::max(maxX, x);
+		minY = std::min(minY, y); maxY = std::max(maxY, y);
+		minZ = std::min(minZ, z); maxZ = std::max(maxZ, z);
+	}
+	m_params.xdim = maxX - minX + 1;
+	m_params.ydim = maxY - minY + 1;
+	m_params.zdim = maxZ - minZ + 1;
+	initialize();
+
+	// Copy the cube states
+	Cube** cit = parent.fragments.begin(fragment);
+	while (cit != parent.fragments.end(fragment))
+	{
+		Cube* cube = *cit++;
+		int x, y, z;
+		parent.id2pos(cube, x, y, z);
+		getCube(x - minX, y - minY, z - minZ)->info = cube->info;
+	}
+	pit = pores.begin();
+	while (pit != pores.end())
+	{
+		Cube* pore = *pit++;
+		int x, y, z;
+		parent.id2pos(pore, x, y, z);
+		getCube(x - minX, y - minY, z - minZ)->info = pore->info;
+	}
+
+	// Load the exposed faces of the fragment
+	cit = parent.fragments.begin(fragment);
+	while (cit != parent.fragments.end(fragment))
+	{
+		int x, y, z;
+		parent.id2pos(*cit++, x, y, z);
+		Cube* cube = getCube(x - minX, y - minY, z - minZ);
+		int face = NUMFACES;
+		while (face--)
+		{
+			if (isExposed(cube->info, face))
+				addFace(cube, face);
+		}
+	}
+	m_initialVolume = parent.fragments.count(fragment);
+	m_maxSurfaceArea = exposedList.size();
+}
+
+// Consumes the whole (sub-)grid recording the surface area change of every removal.
+// Each removal waits an exponential time with a rate equal to the surface area, so the removals of
+// independent grids merged by time pick a face uniformly over all the grids, just like the shared process.
+void MultiCube::consumeDetached(std::vector<DetachedStep>& steps)
+{
+	bool fastRemove = !(m_params.porosity > 0.0);
+	double time = 0.0;
+	Dim_t surfaceArea = (Dim_t)exposedList.size();
+	steps.reserve(m_initialVolume);
+	while ((surfaceArea > 0) && !testDone())
+	{
+		time -= log(nextRandom()) / (double)surfaceArea;	// The stream is never 0
+		if (fastRemove)
+			removeCube();
+		else
+			removeCube(NULL);
+		Dim_t newSurfaceArea = (Dim_t)exposedList.size();
+		DetachedStep step;
+		step.time = time;
+		step.delta = (int)((int64_t)newSurfaceArea - (int64_t)surfaceArea);
+		steps.push_back(step);
+		surfaceArea = newSurfaceArea;
+	}
+	m_cubesRemoved = steps.size();
+}
+
+// Hands every fragment of the last detection to its own sub-grid and consumes them on the worker threads.
+// The sub-grid seeds are drawn in fragment order from the shared generator (results don't depend on the thread count).
+// The removals are then merged by time into the steps replayed by consume(). The grid itself is left empty.
+void MultiCube::detachFragments()
+{
+	std::vector<uint32_t> fragmentList;
+	sortFragments(fragmentList);	// Largest first so the big ones start early
+
+	int64_t nFragments = (int64_t)fragmentList.size();
+	std::vector<uint64_t> seeds(nFragments);
+	for (int64_t i = 0; i < nFragments; i++)
+		seeds[i] = xorshift64();	// Never 0
+
+	std::vector<std::vector<DetachedStep>> steps(nFragments);
+	std::atomic<int64_t> nextFragment(0);
+	unsigned int nThreads = getThreadCount(m_params.nThreads);
+	parallelFor(nThreads, nThreads, [&](int64_t, int64_t, unsigned int)
+	{
+		int64_t i;
+		while ((i = nextFragment++) < nFragments)
+		{
+			MultiCube subGrid(*this, fragmentList[i], seeds[i]);
+			subGrid.consumeDetached(steps[i]);
+		}
+	});
+
+	// Merge the removals by time
+	typedef std::pair<double, int64_t> Pending;	// Time of the next removal, fragment index
+	std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending;
+	std::vector<size_t> next(nFragments, 0);
+	size_t nSteps = 0;
+	for (int64_t i = 0; i < nFragments; i++)
+	{
+		nSteps += steps[i].size();
+		if (!steps[i].empty())
+			pending.push(Pending(steps[i][0].time, i));
+	}
+	m_detachedSteps.reserve(nSteps);
+	while (!pending.empty())
+	{
+		int64_t i = pending.top().second;
+		pending.pop();
+		m_detachedSteps.push_back(steps[i][next[i]++].delta);
+		if (next[i] < steps[i].size())
+			pending.push(Pending(steps[i][next[i]].time, i));
+	}
+	m_detachedNext = 0;
+	m_detachedSurface = exposedList.size();
+
+	// The cubes now live in the replayed steps
+	{
+#ifdef HAS_WXWIDGETS
+#ifdef NEED_THREAD_PROTECTION
+		PortCriticalSection::AutoLock autolock(m_listProtect);	// Protect the lists from display thread
+#endif
+#endif //#ifdef HAS_WXWIDGETS
+		CubePtrs::iterator it = cubeList.begin();
+		while (it != cubeList.end())
+			hide((*it++)->info);
+		cubeList.clear();
+		exposedList.clear();
+		exposedSince.clear();
+		exposedMap.clear();
+	}
+	m_pyramid.clear();	// The replay doesn't keep it up to date
+	if (!m_euler.active() && !m_moments.active())
+		std::vector<uint64_t>().swap(m_solidBits);
+	fragments.clear();
+	fragmentSizes.clear();
+	m_fragStats.reset(0);
+	m_detachReady = false;
 }
 #endif //#ifdef WANT_FRAGMENTATION
 
@@ -1891,37 +3700,34 @@ void MultiCube::outputGrid(char* filename)
 	if (fp == NULL)
 		return;
 
-	Cube* cube = m_Cubes;
-	Dim_t totalCubes = getSize();
-	while (totalCubes--)
+	Dim_t offset = 0;
+	Dim_t end;
+	while ((offset = nextOccupied(offset, end)) < m_gridSize)
 	{
-		if (!visible(cube->info))
-		{	++cube;
-			continue;
-		}
-		if (hasExposed(cube->info))	// Only bother with cubes with exposed faces (no internal cubes)
+		Cube* cube = m_Cubes + offset;
+		for (; offset < end; offset++, cube++)
 		{
-			int xpos, ypos, zpos;
-			id2pos(cube, xpos, ypos, zpos);
+			if (!visible(cube->info))
+				continue;
+			if (hasExposed(cube->info))	// Only bother with cubes with exposed faces (no internal cubes)
+			{
+				int xpos, ypos, zpos;
+				id2pos(cube, xpos, ypos, zpos);
 
 #ifdef WANT_FRAGMENTATION
-			uint32_t  fragment = 0;
-			int size = 0;
-			fragment = getFragmentId(cube->info);
+				uint32_t  fragment = 0;
+				int size = 0;
+				fragment = getFragmentId(cube);
 
-			VectorMap::iterator it = fragments.find(fragment);
-			if (it != fragments.end())
-			{
-				CubePtrs& cubeVect = it->second;
-				size = (int)cubeVect.size();
-			}
+				if (fragment < fragments.labels())
+					size = (int)fragments.count(fragment);
 
-			fprintf(fp, "%d,%d,%d,%d,%d,%d\n", fragment, xpos, ypos, zpos, exposedFaceCount(cube), size);
+				fprintf(fp, "%d,%d,%d,%d,%d,%d\n", fragment, xpos, ypos, zpos, exposedFaceCount(cube), size);
 #else
-			fprintf(fp, "%d,%d,%d,%d\n", xpos, ypos, zpos, exposedFaceCount(cube));
+				fprintf(fp, "%d,%d,%d,%d\n", xpos, ypos, zpos, exposedFaceCount(cube));
 #endif //#ifdef WANT_FRAGMENTATION
+			}
 		}
-		++cube;
 	}
 
 	fclose(fp);
@@ -1947,6 +3753,52 @@ void MultiCube::closeSAData()
 	m_saData_fp = NULL;
 }
 
+// Adds a sample of the surface area (and of the optional columns that are on) to the SA data
+void MultiCube::addSAData(Dim_t surfaceArea, bool fastRemove)
+{
+	SAData pInfo;
+	pInfo.nCubesRemoved = m_cubesRemoved;
+	pInfo.nExposedFaces = surfaceArea;
+#ifdef RANDOM_REMOVAL
+	pInfo.nTotalExposedFaces = (fastRemove && !m_params.naiveRemoval) ? surfaceArea : m_voids.active() ? m_voids.totalSurface() : exposedFaceCount();
+#else
+	(void)fastRemove;
+#endif //#ifdef RANDOM_REMOVAL
+	saData.push_back(pInfo);
+
+#ifdef WANT_FRAGMENTATION
+	if (useIncrementalFragments())
+		saFragments.push_back(m_liveFragments);
+#endif //#ifdef WANT_FRAGMENTATION
+	if (m_params.trackVoids)
+	{
+		VoidSample voids = { m_voids.enclosedVolume(), m_voids.enclosedSurface(), m_voids.breaches() };
+		saVoids.push_back(voids);
+	}
+	if (m_params.trackEuler)
+		saEuler.push_back(m_euler.euler());
+	if (m_params.trackMoments)
+	{
+		ShapeMoments moments;
+		getShapeMoments(moments);
+		ShapeSample shape;
+		for (int i = 0; i < 3; i++)
+		{
+			shape.centroid[i] = moments.centroid[i];
+			shape.principal[i] = moments.principal[i];
+			shape.longAxis[i] = moments.axes[0][i];
+		}
+		saShapes.push_back(shape);
+	}
+	if (m_params.fractalDim)
+		saSurfaceDims.push_back(m_pyramid.active() ? m_pyramid.surfaceDimension() : 0.0);
+	if (m_params.hullStats)
+	{
+		HullSample hull = { 0.0, 0.0, 0.0, 0.0 };	// Measured at the output increments (see measureHull())
+		saHulls.push_back(hull);
+	}
+}
+
 // Utility routine for writing out 3d grid during processing.
 // Output is the current number of cubes removed and the number of exposed faces
 // This routine will be called at each processing interval determined by
@@ -1956,18 +3808,49 @@ void MultiCube::outputSAData()
 	if ((m_saData_fp == NULL) || saData.empty())
 		return;		// Nothing to output
 
-	std::vector<SAData>::iterator it = saData.begin();
-	while(it != saData.end())
-	{	SAData& pInfo = *it++;
+	for (size_t i = 0; i < saData.size(); i++)
+	{	SAData& pInfo = saData[i];
 #ifdef RANDOM_REMOVAL
-	fprintf(m_saData_fp, "%lld,%lld,%lld\n", pInfo.nCubesRemoved, pInfo.nExposedFaces, pInfo.nTotalExposedFaces);
+	fprintf(m_saData_fp, "%lld,%lld,%lld", pInfo.nCubesRemoved, pInfo.nExposedFaces, pInfo.nTotalExposedFaces);
 #else
-	fprintf(m_saData_fp, "%lld,%lld\n", pInfo.nCubesRemoved, pInfo.nExposedFaces);
+	fprintf(m_saData_fp, "%lld,%lld", pInfo.nCubesRemoved, pInfo.nExposedFaces);
 #endif //#ifdef RANDOM_REMOVAL
+#ifdef WANT_FRAGMENTATION
+	if (!saFragments.empty())
+		fprintf(m_saData_fp, ",%d", saFragments[i]);
+#endif //#ifdef WANT_FRAGMENTATION
+	if (!saVoids.empty())
+		fprintf(m_saData_fp, ",%lld,%lld,%lld", saVoids[i].nEnclosedVoid, saVoids[i].nEnclosedFaces, saVoids[i].nBreaches);
+	if (!saEuler.empty())
+		fprintf(m_saData_fp, ",%lld", (long long)saEuler[i]);
+	if (!saShapes.empty())
+	{	// Centroid, principal moments (smallest first) and the long axis
+		ShapeSample& shape = saShapes[i];
+		fprintf(m_saData_fp, ",%g,%g,%g", shape.centroid[0], shape.centroid[1], shape.centroid[2]);
+		fprintf(m_saData_fp, ",%g,%g,%g", shape.principal[0], shape.principal[1], shape.principal[2]);
+		fprintf(m_saData_fp, ",%g,%g,%g", shape.longAxis[0], shape.longAxis[1], shape.longAxis[2]);
+	}
+	if (!saSurfaceDims.empty())
+		fprintf(m_saData_fp, ",%g", saSurfaceDims[i]);
+	if (!saHulls.empty())
+	{
+		HullSample& hull = saHulls[i];
+		if (hull.volume > 0.0)
+			fprintf(m_saData_fp, ",%.10g,%.10g,%g,%g", hull.volume, hull.area, hull.sphericity, hull.convexity);
+		else
+			fprintf(m_saData_fp, ",,,,");	// Between increments
+	}
+	fprintf(m_saData_fp, "\n");
 	}
 	fflush(m_saData_fp);
 
 	saData.clear();	// Done writing this chunk, clear the old data
+	saFragments.clear();
+	saVoids.clear();
+	saEuler.clear();
+	saShapes.clear();
+	saSurfaceDims.clear();
+	saHulls.clear();
 }
 
 #ifdef WANT_INPUT_CONTROL
@@ -2058,20 +3941,39 @@ void MultiCube::importObject(char* fname)
 bool MultiCube::consume(double& threshhold, int* progress/*=NULL*/)
 {
 	bool fastRemove = !(m_params.porosity > 0.0);
+#ifdef WANT_FRAGMENTATION
+	if (useIncrementalFragments() && !m_fragsSeeded)
+		seedFragments();	// Label the fragments once, they're then updated after every removal
+	if (m_params.fragTimeline && !m_recordRemovals)
+		startTimeline();	// Log the removals from here on
+	if (m_detachReady)
+		detachFragments();	// The fragments found by the last detection are consumed on their own from here on
+	bool detached = !m_detachedSteps.empty();
+	if (detached)
+		fastRemove = true;	// The steps are replayed (the surface area is all there is to report)
+#endif //#ifdef WANT_FRAGMENTATION
+	if (m_params.trackVoids && !m_voids.active())
+		startVoidTracking();
+	if (m_params.trackEuler && !m_euler.active())
+		startEulerTracking();
+	if (m_params.trackMoments && !m_moments.active())
+		startMomentTracking();
+	if (m_params.trackFaceAge && !m_faceAges.active())
+		startFaceAgeTracking();
 	Dim_t surfaceArea = (Dim_t)exposedList.size();
+#ifdef WANT_FRAGMENTATION
+	if (detached)
+		surfaceArea = m_detachedSurface;
+#endif //#ifdef WANT_FRAGMENTATION
 	while ((surfaceArea > 0) && !testDone())
 	{
+		// Cavity breaches make the surface area jump so they're always sampled
 		if (m_params.outputSave && (m_lastRemoved != m_cubesRemoved) &&
-			((m_params.outputSubsamp == 1) || !(m_cubesRemoved % m_params.outputSubsamp)))
+			((m_params.outputSubsamp == 1) || !(m_cubesRemoved % m_params.outputSubsamp) || m_cavityBreached))
 		{	// Add processing information to the vector
-			SAData pInfo;
-			pInfo.nCubesRemoved = m_cubesRemoved;
-			pInfo.nExposedFaces = surfaceArea;
-#ifdef RANDOM_REMOVAL
-			pInfo.nTotalExposedFaces = (fastRemove && !m_params.naiveRemoval) ? surfaceArea : exposedFaceCount();
-#endif //#ifdef RANDOM_REMOVAL
-			saData.push_back(pInfo);
+			addSAData(surfaceArea, fastRemove);
 			m_lastRemoved = m_cubesRemoved;
+			m_cavityBreached = false;
 		}
 #ifdef HAS_WXWIDGETS
 		if (m_params.displayEnable && ((m_params.outputSubsamp == 1) || !(m_cubesRemoved % m_params.outputSubsamp)))
@@ -2096,19 +3998,39 @@ bool MultiCube::consume(double& threshhold, int* progress/*=NULL*/)
 			}
 			if (progress)
 				*progress = (int)round(ratio_removed*100.0);
+			if (m_params.hullStats && !saData.empty() && (saData.back().nCubesRemoved == m_cubesRemoved))
+				measureHull(saHulls.back(), saData.back().nExposedFaces);	// The hull is only taken at the output increments
 
 			return(true);
 		}
 		// Remove a random cube from the exposed face map
+		Cube* removedCube;
+#ifdef WANT_FRAGMENTATION
+		if (detached)
+		{
+			if (m_detachedNext == m_detachedSteps.size())
+				break;	// Stopped before the fragments were consumed
+			m_detachedSurface += m_detachedSteps[m_detachedNext++];
+			++m_cubesRemoved;
+			surfaceArea = m_detachedSurface;
+			continue;
+		}
+#endif //#ifdef WANT_FRAGMENTATION
 #ifdef RANDOM_REMOVAL
 		if (m_params.naiveRemoval)
-			naiveRemoveCube();
+			removedCube = naiveRemoveCube();
 		else 
 #endif //#ifdef RANDOM_REMOVAL
 		if (fastRemove)
-			removeCube();
+			removedCube = removeCube();
 		else
-			removeCube(NULL);
+			removedCube = removeCube(NULL);
+#ifdef WANT_FRAGMENTATION
+		if (m_fragsSeeded)
+			updateFragments(removedCube);	// Check if the removal split a fragment
+#else
+		(void)removedCube;
+#endif //#ifdef WANT_FRAGMENTATION
 
 		++m_cubesRemoved;							// increment # of cubes removed
 		surfaceArea = (Dim_t)exposedList.size();	// adjust exposed faces count by net gain/loss due to cube removal
@@ -2116,13 +4038,9 @@ bool MultiCube::consume(double& threshhold, int* progress/*=NULL*/)
 	
 	if (m_params.outputSave && (m_lastRemoved != m_cubesRemoved))
 	{	// Add processing information to the vector (last one!)
-		SAData pInfo;
-		pInfo.nCubesRemoved = m_cubesRemoved;
-		pInfo.nExposedFaces = surfaceArea;
-#ifdef RANDOM_REMOVAL
-		pInfo.nTotalExposedFaces = (fastRemove && !m_params.naiveRemoval) ? surfaceArea : exposedFaceCount();
-#endif //#ifdef RANDOM_REMOVAL
-		saData.push_back(pInfo);
+		addSAData(surfaceArea, fastRemove);
+		if (m_params.hullStats)
+			measureHull(saHulls.back(), surfaceArea);
 		m_lastRemoved = m_cubesRemoved;
 	}
 #ifdef HAS_WXWIDGETS
@@ -2213,6 +4131,7 @@ bool MultiCube::produceParticles(double& threshhold, int* progress)
 #define FILL_PERCENT	(0.37)
 #define SPHERE_SCALAR	((4.0 / 3.0) * 3.141592635)
 #define MAG_ROUND		(0.5)
+#define AGG_BATCH_SIZE	(4096)	// Maximum candidates generated per parallel batch
 //#define MAX_NEIGHBORS	(32)
 
 /*-------------------------------------------------------------------------------------------------------------------------------------
@@ -2237,8 +4156,11 @@ bool MultiCube::produceParticles(double& threshhold, int* progress)
 		f:	Scan the aggregate particles and verify that the new candidate doesn't overlap any of the aggregate particles (i.e. not enough space between particles).
 		g:	If the candidate sub-particle passes both of the above tests it is added to the aggregate list.
 	3: If the number of attempts to find room for a new particle exceeds a "number of tries" threshold we stop trying.
+ When more than one thread is available steps a-f are performed on batches of candidates in parallel against a snapshot
+ of the aggregate. The candidates are then committed in order, each being rechecked only against the particles
+ committed earlier in the same batch, so the result doesn't depend on the number of threads.
 --------------------------------------------------------------------------------------------------------------------------------------*/
-Aggregate::Aggregate(bool isCuboid, double xd, double yd, double zd, double pd) : m_isCuboid(isCuboid), m_xd(xd), m_yd(yd), m_zd(zd), m_pd(pd)
+Aggregate::Aggregate(bool isCuboid, double xd, double yd, double zd, double pd, unsigned int nThreads/*=1*/) : m_isCuboid(isCuboid), m_xd(xd), m_yd(yd), m_zd(zd), m_pd(pd), m_nThreads(nThreads)
 {
 	// Get radii for convenience
 	m_xr = m_xd / 2;
@@ -2246,6 +4168,22 @@ Aggregate::Aggregate(bool isCuboid, double xd, double yd, double zd, double pd)
 	m_zr = m_zd / 2;
 	m_pr = m_pd / 2;
 
+	if (m_isCuboid)
+		m_containerVolume = m_xd * m_yd * m_zd;
+	else
+		m_containerVolume = SPHERE_SCALAR * (m_xr * m_yr * m_zr);
+	m_particleVolume = SPHERE_SCALAR * (m_pr * m_pr * m_pr);
+	m_expected = (uint64_t)((m_containerVolume / m_particleVolume) * FILL_PERCENT);
+
+	// Size the spatial index so that any overlapping particle lies within the 27 cells surrounding a candidate
+	m_cellSize = m_pd + MAG_ROUND;
+	m_cellDims[0] = (int)(m_xd / m_cellSize) + 1;
+	m_cellDims[1] = (int)(m_yd / m_cellSize) + 1;
+	m_cellDims[2] = (int)(m_zd / m_cellSize) + 1;
+	m_cellHead.assign((size_t)m_cellDims[0] * m_cellDims[1] * m_cellDims[2], -1);
+	m_points.reserve((size_t)m_expected + 1);
+	m_cellNext.reserve((size_t)m_expected + 1);
+
 	// Create an initial point at the center of the container offset by the radius of the particle
 	double pAdj = 0;
 	int ipd = (int)m_pd;
@@ -2257,14 +4195,7 @@ Aggregate::Aggregate(bool isCuboid, double xd, double yd, double zd, double pd)
 	p.y = m_yr + pAdj;
 	p.z = m_zr + pAdj;
 
-	m_points.push_back(p);
-
-	if (m_isCuboid)
-		m_containerVolume = m_xd * m_yd * m_zd;
-	else
-		m_containerVolume = SPHERE_SCALAR * (m_xr * m_yr * m_zr);
-	m_particleVolume = SPHERE_SCALAR * (m_pr * m_pr * m_pr);
-	m_expected = (uint64_t)((m_containerVolume / m_particleVolume) * FILL_PERCENT);
+	updateParticleNeighbors(p);
 }
 
 void Aggregate::generateParticles(bool verbose/*=true*/)
@@ -2275,27 +4206,80 @@ void Aggregate::generateParticles(bool verbose/*=true*/)
 		sendMessage(message);
 	}
 
+	generateParticlesBatched(verbose);
+}
+
+// Generate and validate batches of candidates in parallel against a snapshot of the aggregate
+// then commit them in candidate order. The commit reproduces the serial process exactly (each trial
+// anchors to a particle present when it's committed) so the thread count only changes the speed.
+void Aggregate::generateParticlesBatched(bool verbose)
+{
 	double pMag = m_xr - m_pr;
 
+	std::vector<double>		draws;
+	std::vector<point3d>	candidates;
+	std::vector<int>		anchors;
+	std::vector<char>		passed;
+
 	uint64_t nMisses = 0;
 	while ((m_points.size() < m_expected) && (nMisses < MAX_MISSES))
 	{
-		if (((m_points.size() % 10000) == 0) && (nMisses == 0))
-		{
-			std::string message = format("%d of %d points generated\n", m_points.size(), m_expected);
-			sendMessage(message);
-		}
-		int aggIndex = 0;
-		point3d p = generateParticle(aggIndex);
-		if (validateParticle(p, pMag, aggIndex))
+		// Limit the batch to a fraction of the aggregate so most candidates still pick the same anchor when they are committed
+		int nPoints = (int)m_points.size();
+		int batchSize = nPoints / 8;
+		if (batchSize < 1)
+			batchSize = 1;
+		else if (batchSize > AGG_BATCH_SIZE)
+			batchSize = AGG_BATCH_SIZE;
+
+		// Draw the random numbers up front from a copy of the generator so the candidates are the same regardless of the thread count
+		// (the generator is only advanced past the trials actually committed below)
+		uint64_t state = xorState;
+		draws.resize(batchSize * 4);
+		for (int i = 0; i < batchSize * 4; i++)
+			draws[i] = xrand(state);
+
+		candidates.resize(batchSize);
+		anchors.resize(batchSize);
+		passed.resize(batchSize);
+		parallelFor(batchSize, m_nThreads, [&](int64_t begin, int64_t end, unsigned int) {
+			for (int64_t i = begin; i < end; i++)
+			{
+				candidates[i] = placeParticle(&draws[i * 4], nPoints, anchors[i]);
+				passed[i] = validateParticle(candidates[i], pMag, anchors[i]);
+			}
+		});
+
+		// Commit in order. The anchor is drawn again from the particles committed so far; when it's unchanged the candidate
+		// is only rechecked against the particles added by this batch, otherwise it's placed against the new anchor and checked in full
+		int nTrials = 0;
+		for (int i = 0; (i < batchSize) && (m_points.size() < m_expected) && (nMisses < MAX_MISSES); i++, nTrials++)
 		{
-			updateParticleNeighbors(p);
-			nMisses = 0;	// Found a valid particle, reset the escape counter
-			//if (m_points.size() == 3)
-			//	break;
+			int nCommitted = (int)m_points.size();
+			int anchor = (int)(draws[i * 4] * nCommitted);
+			bool valid;
+			if (anchor == anchors[i])
+				valid = passed[i] && validateParticle(candidates[i], pMag, anchor, nPoints);
+			else
+			{
+				candidates[i] = placeParticle(&draws[i * 4], nCommitted, anchor);
+				valid = validateParticle(candidates[i], pMag, anchor);
+			}
+			if (valid)
+			{
+				updateParticleNeighbors(candidates[i]);
+				nMisses = 0;
+				if ((m_points.size() % 10000) == 0)
+				{
+					std::string message = format("%d of %d points generated\n", m_points.size(), m_expected);
+					sendMessage(message);
+				}
+			}
+			else
+				++nMisses;
 		}
-		else
-			++nMisses;	// Increment the escape count while searching for a valid particle 
+		for (int i = 0; i < nTrials * 4; i++)	// Consume the same random numbers as the trials committed
+			xorshift64();
 	}
 	if (verbose)
 	{
@@ -2304,17 +4288,18 @@ void Aggregate::generateParticles(bool verbose/*=true*/)
 	}
 }
 
-point3d Aggregate::generateParticle(int& index)
+// Create a candidate from four uniform random numbers (anchor selection followed by a point in the volume)
+point3d Aggregate::placeParticle(const double* r, int nPoints, int& index)
 {
 	// Pick an existing point from the list (the center of a sub-particle)
-	index = (int)(xrand() * m_points.size());
+	index = (int)(r[0] * nPoints);
 	point3d c = m_points[index];
 
 	// Create a random point somewhere in the volume
 	point3d p;
-	p.x = (xrand() * m_xd);
-	p.y = (xrand() * m_yd);
-	p.z = (xrand() * m_zd);
+	p.x = (r[1] * m_xd);
+	p.y = (r[2] * m_yd);
+	p.z = (r[3] * m_zd);
 
 	// Create a vector from selected point to random point
 	point3d np;
@@ -2334,7 +4319,8 @@ point3d Aggregate::generateParticle(int& index)
 	return(np);
 }
 
-bool Aggregate::validateParticle(point3d p, double pMag, int index)
+// Only particles numbered first and above are checked for overlap
+bool Aggregate::validateParticle(point3d p, double pMag, int index, int first/*=0*/)
 {
 	bool condition;
 	// Verify that the particle will be within the volume of the container
@@ -2370,21 +4356,40 @@ bool Aggregate::validateParticle(point3d p, double pMag, int index)
 	if (condition)
 	{
 		// Verify the new particle doesn't overlap with any existing particles
-		point3d& aggp = m_points[index];	// Get the point we're trying to stick to
-		// Scan though the current aggregates neighbors and check for a possible collision
+		// Scan the particles in the cells surrounding the candidate and check for a possible collision
+		// (The particle we're trying to stick to is excluded since the candidate was placed against it)
 		double dMax = m_pd + MAG_ROUND;
-		std::vector<int>::iterator ait = aggp.neighbors.begin();
-		while (ait != aggp.neighbors.end())
-		{
-			// Get a particle center off the list
-			// Compute the distance to the new particle center
-			point3d& c = m_points[*ait++];
-			double xdiff = (c.x - p.x);
-			double ydiff = (c.y - p.y);
-			double zdiff = (c.z - p.z);
-			double mag = sqrt(xdiff * xdiff + ydiff * ydiff + zdiff * zdiff);
-			if (mag < dMax)	// The new particle would overlap an existing one (Fail!!)
-				return(false);
+		int cx, cy, cz;
+		getCell(p, cx, cy, cz);
+		int x0 = (cx > 0) ? cx - 1 : 0, x1 = (cx < m_cellDims[0] - 1) ? cx + 1 : cx;
+		int y0 = (cy > 0) ? cy - 1 : 0, y1 = (cy < m_cellDims[1] - 1) ? cy + 1 : cy;
+		int z0 = (cz > 0) ? cz - 1 : 0, z1 = (cz < m_cellDims[2] - 1) ? cz + 1 : cz;
+		for (int z = z0; z <= z1; z++)
+		{
+			for (int y = y0; y <= y1; y++)
+			{
+				int rowBase = (z * m_cellDims[1] + y) * m_cellDims[0];
+				for (int x = x0; x <= x1; x++)
+				{
+					// Cells are linked newest first so the scan can stop at the first particle below the range
+					int pIndex = m_cellHead[rowBase + x];
+					while (pIndex >= first)
+					{
+						// Compute the distance to the new particle center
+						if (pIndex != index)
+						{
+							point3d& c = m_points[pIndex];
+							double xdiff = (c.x - p.x);
+							double ydiff = (c.y - p.y);
+							double zdiff = (c.z - p.z);
+							double mag = sqrt(xdiff * xdiff + ydiff * ydiff + zdiff * zdiff);
+							if (mag < dMax)	// The new particle would overlap an existing one (Fail!!)
+								return(false);
+						}
+						pIndex = m_cellNext[pIndex];
+					}
+				}
+			}
 		}
 		return(true);	// Success!!
 	}
@@ -2392,33 +4397,32 @@ bool Aggregate::validateParticle(point3d p, double pMag, int index)
 	return(false);
 }
 
+// Get the spatial index cell containing a particle center (clamped to the grid)
+int Aggregate::getCell(const point3d& p, int& cx, int& cy, int& cz)
+{
+	cx = (int)floor(p.x / m_cellSize);
+	cy = (int)floor(p.y / m_cellSize);
+	cz = (int)floor(p.z / m_cellSize);
+	cx = (cx < 0) ? 0 : ((cx >= m_cellDims[0]) ? m_cellDims[0] - 1 : cx);
+	cy = (cy < 0) ? 0 : ((cy >= m_cellDims[1]) ? m_cellDims[1] - 1 : cy);
+	cz = (cz < 0) ? 0 : ((cz >= m_cellDims[2]) ? m_cellDims[2] - 1 : cz);
+	return((cz * m_cellDims[1] + cy) * m_cellDims[0] + cx);
+}
+
+// Add a new particle to the aggregate and link it into its spatial index cell
 void Aggregate::updateParticleNeighbors(point3d& p)
 {
-	double dMax = m_pd + m_pd;
+	int cx, cy, cz;
+	int cell = getCell(p, cx, cy, cz);
 	int nPoints = (int)m_points.size();
-	// Update the neighbor fields of the new particle and its neighbors
-	for (int index = 0; index < nPoints; index++)
-	{
-		// Get a particle center off the list
-		// Compute the distance to the new particle center
-		point3d& c = m_points[index];
-		double xdiff = c.x - p.x;
-		double ydiff = c.y - p.y;
-		double zdiff = c.z - p.z;
-		double mag = sqrt(xdiff * xdiff + ydiff * ydiff + zdiff * zdiff);
-		// Adjust the new particle's neighbors
-		if (mag <= dMax)
-		{
-			p.neighbors.push_back(index);
-			c.neighbors.push_back(nPoints);
-		}
-	}
+	m_cellNext.push_back(m_cellHead[cell]);
+	m_cellHead[cell] = nPoints;
 	m_points.push_back(p);
 }
 
 void Aggregate::fractalGeneration(pointVect& displayPoints, point3d cOffset, double xd, double yd, double zd, double pd, double& pSize)
 {
-	Aggregate aggregate(m_isCuboid, xd, yd, zd, pd);
+	Aggregate aggregate(m_isCuboid, xd, yd, zd, pd, m_nThreads);
 	aggregate.generateParticles(false);
 	pointVect& points = aggregate.getParticles();
 
@@ -0,0 +1,235 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include "OccupancyPyramid.h"
+#include <math.h>
+
+void OccupancyPyramid::clear()
+{
+	m_active = false;
+	for (int level = 0; level < PYRAMID_LEVELS; level++)
+	{
+		m_counts[level].clear();
+		m_counts[level].shrink_to_fit();
+		m_occupied[level] = m_surface[level] = 0;
+	}
+}
+
+void OccupancyPyramid::build(int xdim, int ydim, int zdim, unsigned int nThreads, const uint64_t* solid)
+{
+	m_dims[0] = xdim;
+	m_dims[1] = ydim;
+	m_dims[2] = zdim;
+	m_rowSize = xdim;
+	m_layerSize = m_rowSize * ydim;
+	fillLevels(nThreads, solid);
+
+	m_active = true;
+}
+
+// Counts the boxes of every level from the bit grid
+void OccupancyPyramid::fillLevels(unsigned int nThreads, const uint64_t* solid)
+{
+	for (int level = 0; level < PYRAMID_LEVELS; level++)
+	{
+		int size = boxSize(level);
+		for (int axis = 0; axis < 3; axis++)
+			m_boxDims[level][axis] = (m_dims[axis] + size - 1) / size;
+		m_counts[level].assign((size_t)m_boxDims[level][0] * m_boxDims[level][1] * m_boxDims[level][2], 0);
+	}
+
+	// Finest level from the cells. Each thread owns whole layers of boxes.
+	int* boxDims = m_boxDims[0];
+	parallelFor(boxDims[2], nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		uint32_t* counts = m_counts[0].data();
+		for (int z = (int)begin * 4; (z < (int)end * 4) && (z < m_dims[2]); z++)
+		{
+			for (int y = 0; y < m_dims[1]; y++)
+			{
+				uint32_t* row = counts + ((size_t)(z >> 2) * boxDims[1] + (y >> 2)) * boxDims[0];
+				uint64_t offset = z * m_layerSize + y * m_rowSize;
+				for (int x = 0; x < m_dims[0]; x++, offset++)
+					row[x >> 2] += (uint32_t)((solid[offset >> 6] >> (offset & 63)) & 1);
+			}
+		}
+	});
+
+	// Each coarser box is the sum of 2x2x2 boxes of the level below
+	for (int level = 1; level < PYRAMID_LEVELS; level++)
+	{
+		int* dims = m_boxDims[level];
+		int* fineDims = m_boxDims[level - 1];
+		const uint32_t* fine = m_counts[level - 1].data();
+		uint32_t* coarse = m_counts[level].data();
+		parallelFor(dims[2], nThreads, [&](int64_t begin, int64_t end, unsigned int)
+		{
+			for (int bz = (int)begin; bz < (int)end; bz++)
+				for (int by = 0; by < dims[1]; by++)
+					for (int bx = 0; bx < dims[0]; bx++)
+					{
+						uint32_t count = 0;
+						for (int fz = 2 * bz; (fz <= 2 * bz + 1) && (fz < fineDims[2]); fz++)
+							for (int fy = 2 * by; (fy <= 2 * by + 1) && (fy < fineDims[1]); fy++)
+								for (int fx = 2 * bx; (fx <= 2 * bx + 1) && (fx < fineDims[0]); fx++)
+									count += fine[((size_t)fz * fineDims[1] + fy) * fineDims[0] + fx];
+						coarse[((size_t)bz * dims[1] + by) * dims[0] + bx] = count;
+					}
+		});
+	}
+
+	for (int level = 0; level < PYRAMID_LEVELS; level++)
+	{
+		int* dims = m_boxDims[level];
+		m_occupied[level] = m_surface[level] = 0;
+		const uint32_t* counts = m_counts[level].data();
+		for (int bz = 0; bz < dims[2]; bz++)
+			for (int by = 0; by < dims[1]; by++)
+				for (int bx = 0; bx < dims[0]; bx++)
+				{
+					uint32_t count = *counts++;
+					if (count)
+						++m_occupied[level];
+					if (isSurface(level, bx, by, bz, count))
+						++m_surface[level];
+				}
+	}
+}
+
+// A box holds surface if it has both solid and void, or solid on the grid boundary (the exterior is void)
+bool OccupancyPyramid::isSurface(int level, int bx, int by, int bz, uint32_t count)
+{
+	if (!count)
+		return(false);
+	int size = boxSize(level);
+	int box[3] = { bx, by, bz };
+	uint64_t capacity = 1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		int first = box[axis] * size;
+		int last = first + size;
+		if ((first == 0) || (last >= m_dims[axis]))
+			return(true);
+		capacity *= size;
+	}
+	return(count < capacity);
+}
+
+void OccupancyPyramid::change(uint64_t offset, int delta)
+{
+	int x = (int)(offset % m_rowSize);
+	int y = (int)((offset % m_layerSize) / m_rowSize);
+	int z = (int)(offset / m_layerSize);
+	for (int level = 0; level < PYRAMID_LEVELS; level++)
+	{
+		int shift = level + 2;
+		int bx = x >> shift;
+		int by = y >> shift;
+		int bz = z >> shift;
+		uint32_t& count = m_counts[level][((size_t)bz * m_boxDims[level][1] + by) * m_boxDims[level][0] + bx];
+		uint32_t before = count;
+		count += delta;
+		if (!before != !count)
+			m_occupied[level] += delta;
+
+		uint32_t full = 1U << (3 * shift);	// A box only turns to or from surface when it empties or fills
+		if (!before || !count || (before == full) || (count == full))
+		{
+			bool wasSurface = isSurface(level, bx, by, bz, before);
+			bool nowSurface = isSurface(level, bx, by, bz, count);
+			if (wasSurface != nowSurface)
+				m_surface[level] += nowSurface ? 1 : -1;
+		}
+	}
+}
+
+uint64_t OccupancyPyramid::nextOccupied(uint64_t offset, uint64_t& end)
+{
+	uint64_t gridSize = m_layerSize * m_dims[2];
+	while (offset < gridSize)
+	{
+		int x = (int)(offset % m_rowSize);
+		int y = (int)((offset % m_layerSize) / m_rowSize);
+		int z = (int)(offset / m_layerSize);
+		uint64_t rowEnd = offset - x + m_rowSize;
+
+		int* dims = m_boxDims[PYRAMID_COARSE_SKIP];
+		int shift = PYRAMID_COARSE_SKIP + 2;
+		if (!m_counts[PYRAMID_COARSE_SKIP][((size_t)(z >> shift) * dims[1] + (y >> shift)) * dims[0] + (x >> shift)])
+		{
+			uint64_t next = offset + ((1ULL << shift) - (x & ((1 << shift) - 1)));
+			offset = (next < rowEnd) ? next : rowEnd;
+			continue;
+		}
+
+		dims = m_boxDims[PYRAMID_FINE_SKIP];
+		shift = PYRAMID_FINE_SKIP + 2;
+		uint64_t next = offset + ((1ULL << shift) - (x & ((1 << shift) - 1)));
+		if (next > rowEnd)
+			next = rowEnd;
+		if (!m_counts[PYRAMID_FINE_SKIP][((size_t)(z >> shift) * dims[1] + (y >> shift)) * dims[0] + (x >> shift)])
+		{
+			offset = next;
+			continue;
+		}
+
+		end = next;
+		return(offset);
+	}
+
+	end = gridSize;
+	return(gridSize);
+}
+
+double OccupancyPyramid::dimension(const uint64_t* boxes)
+{
+	double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+	int points = 0;
+	for (int level = 0; level < PYRAMID_LEVELS; level++)
+	{
+		if (!boxes[level])
+			continue;
+		double x = -log((double)boxSize(level));
+		double y = log((double)boxes[level]);
+		sumX += x;
+		sumY += y;
+		sumXX += x * x;
+		sumXY += x * y;
+		++points;
+	}
+	if (points < 2)
+		return(0.0);
+	return((points * sumXY - sumX * sumY) / (points * sumXX - sumX * sumX));
+}
+
+double OccupancyPyramid::massDimension()
+{
+	return(dimension(m_occupied));
+}
+
+double OccupancyPyramid::surfaceDimension()
+{
+	return(dimension(m_surface));
+}
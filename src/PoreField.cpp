@@ -0,0 +1,188 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+
+#include <math.h>
+
+#include "PoreField.h"
+#include "Parallel.h"
+
+// Mixes a seed and a stream index into a well distributed non-zero generator state
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	x ^= (x >> 31);
+	return(x ? x : 0x9E3779B97F4A7C15ULL);
+}
+
+void generateNoiseField(std::vector<float>& field, int xdim, int ydim, int zdim, uint64_t seed, unsigned int nThreads)
+{
+	field.resize((size_t)xdim * ydim * zdim);
+	int64_t nRows = (int64_t)ydim * zdim;
+	parallelFor(nRows, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		for (int64_t row = begin; row < end; row++)
+		{
+			uint64_t state = splitmix64(seed ^ ((uint64_t)row * 0xD1B54A32D192ED03ULL));
+			float* value = &field[(size_t)row * xdim];
+			for (int x = 0; x < xdim; x++)
+			{
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				value[x] = (float)(state >> 40) * (1.0f / 16777216.0f);	// 24 bits of mantissa
+			}
+		}
+	});
+}
+
+// Builds the filter taps for offsets -radius..radius
+static int getKernel(int filter, double width, std::vector<double>& taps)
+{
+	int radius;
+	if (filter == FIELD_FILTER_GAUSSIAN)
+	{
+		double sigma = width / 2.0;
+		radius = (int)ceil(3.0 * sigma);
+		taps.resize(2 * radius + 1);
+		for (int k = -radius; k <= radius; k++)
+			taps[k + radius] = exp(-(double)(k * k) / (2.0 * sigma * sigma));
+	}
+	else
+	{
+		radius = (int)(width / 2.0);
+		taps.assign(2 * radius + 1, 1.0);
+	}
+	return(radius);
+}
+
+// Reciprocal of the sum of the taps that fall inside [0, n) for each position (renormalises the truncated windows)
+static void getNormals(const std::vector<double>& taps, int radius, int n, std::vector<float>& normals)
+{
+	normals.resize(n);
+	for (int i = 0; i < n; i++)
+	{
+		double sum = 0;
+		for (int k = -radius; k <= radius; k++)
+		{
+			if ((i + k >= 0) && (i + k < n))
+				sum += taps[k + radius];
+		}
+		normals[i] = (float)(1.0 / sum);
+	}
+}
+
+// out[i] = normals[i] * sum(taps[k] * in[i+k]) where in and out are rows of length elements.
+// Rows are addressed through base and stride so the same routine filters lines of values or lines of rows.
+static void filterLine(const float* in, float* out, int n, size_t stride, int length, const std::vector<float>& taps, int radius, const std::vector<float>& normals)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float* dst = out + i * stride;
+		for (int e = 0; e < length; e++)
+			dst[e] = 0;
+		int k0 = (i < radius) ? -i : -radius;
+		int k1 = (i + radius >= n) ? n - 1 - i : radius;
+		for (int k = k0; k <= k1; k++)
+		{
+			const float* src = in + (i + k) * stride;
+			float w = taps[k + radius];
+			for (int e = 0; e < length; e++)
+				dst[e] += w * src[e];
+		}
+		float norm = normals[i];
+		for (int e = 0; e < length; e++)
+			dst[e] *= norm;
+	}
+}
+
+void smoothField(std::vector<float>& field, int xdim, int ydim, int zdim, int filter, double width, unsigned int nThreads)
+{
+	if (width <= 1.0)
+		return;
+
+	std::vector<double> taps;
+	int radius = getKernel(filter, width, taps);
+	if (radius < 1)
+		return;
+	std::vector<float> ftaps(taps.begin(), taps.end());
+
+	std::vector<float> xNormals, yNormals, zNormals;
+	getNormals(taps, radius, xdim, xNormals);
+	getNormals(taps, radius, ydim, yNormals);
+	getNormals(taps, radius, zdim, zNormals);
+
+	size_t layerSize = (size_t)xdim * ydim;
+
+	// X pass: each row is filtered independently
+	parallelFor((int64_t)ydim * zdim, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		std::vector<float> line(xdim);
+		for (int64_t row = begin; row < end; row++)
+		{
+			float* value = &field[(size_t)row * xdim];
+			for (int x = 0; x < xdim; x++)
+				line[x] = value[x];
+			filterLine(&line[0], value, xdim, 1, 1, ftaps, radius, xNormals);
+		}
+	});
+
+	// Y pass: whole rows of a layer are combined at once (contiguous in memory)
+	parallelFor((int64_t)zdim, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		std::vector<float> layer(layerSize);
+		for (int64_t z = begin; z < end; z++)
+		{
+			float* value = &field[(size_t)z * layerSize];
+			for (size_t i = 0; i < layerSize; i++)
+				layer[i] = value[i];
+			filterLine(&layer[0], value, ydim, xdim, xdim, ftaps, radius, yNormals);
+		}
+	});
+
+	// Z pass: the rows at a given y are gathered from every layer, filtered and written back
+	parallelFor((int64_t)ydim, nThreads, [&](int64_t begin, int64_t end, unsigned int)
+	{
+		std::vector<float> in((size_t)xdim * zdim);
+		std::vector<float> out((size_t)xdim * zdim);
+		for (int64_t y = begin; y < end; y++)
+		{
+			for (int z = 0; z < zdim; z++)
+			{
+				const float* value = &field[(size_t)z * layerSize + (size_t)y * xdim];
+				for (int x = 0; x < xdim; x++)
+					in[(size_t)z * xdim + x] = value[x];
+			}
+			filterLine(&in[0], &out[0], zdim, xdim, xdim, ftaps, radius, zNormals);
+			for (int z = 0; z < zdim; z++)
+			{
+				float* value = &field[(size_t)z * layerSize + (size_t)y * xdim];
+				for (int x = 0; x < xdim; x++)
+					value[x] = out[(size_t)z * xdim + x];
+			}
+		}
+	});
+}
@@ -0,0 +1,124 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#include "VoidTracker.h"
+
+void VoidTracker::clear()
+{
+	m_active = false;
+	m_parent.clear();
+	m_parent.shrink_to_fit();
+	m_sets.clear();
+	m_voidVolume = 0;
+	m_surface = 0;
+	m_breaches = 0;
+}
+
+// Union by volume. The statistics of the absorbed set are added to the surviving root.
+uint32_t VoidTracker::unite(uint32_t a, uint32_t b)
+{
+	a = find(a);
+	b = find(b);
+	if (a == b)
+		return(a);
+	VoidSet& setA = m_sets[a];
+	VoidSet& setB = m_sets[b];
+	if (setA.volume < setB.volume)
+	{
+		setB.volume += setA.volume;
+		setB.surface += setA.surface;
+		m_parent[a] = b;
+		m_sets.erase(a);
+		return(b);
+	}
+	setA.volume += setB.volume;
+	setA.surface += setB.surface;
+	m_parent[b] = a;
+	m_sets.erase(b);
+	return(a);
+}
+
+bool VoidTracker::removeCube(uint64_t offset)
+{
+	if (!m_active || (m_parent[offset] != SOLID))
+		return(false);	// Already void
+
+	int x = (int)(offset % m_rowSize);
+	int y = (int)((offset / m_rowSize) % m_dims[1]);
+	int z = (int)(offset / m_layerSize);
+	int pos[3] = { x, y, z };
+	int64_t step[3] = { 1, (int64_t)m_rowSize, (int64_t)m_layerSize };
+
+	uint32_t roots[7];	// Distinct void sets touched (6 neighbors + the exterior)
+	int nRoots = 0;
+	int solidFaces = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int dir = -1; dir <= 1; dir += 2)
+		{
+			int p = pos[axis] + dir;
+			uint32_t adjRoot;
+			if ((p < 0) || (p >= m_dims[axis]))
+				adjRoot = find(m_exterior);
+			else
+			{
+				uint64_t adj = offset + dir * step[axis];
+				if (m_parent[adj] == SOLID)
+				{
+					++solidFaces;
+					continue;
+				}
+				adjRoot = find((uint32_t)adj);
+			}
+			// The face between the cube and this void no longer counts as surface
+			--m_sets[adjRoot].surface;
+			--m_surface;
+			int r = 0;
+			while ((r < nRoots) && (roots[r] != adjRoot))
+				++r;
+			if (r == nRoots)
+				roots[nRoots++] = adjRoot;
+		}
+	}
+
+	// The cube becomes void with its solid neighbors' faces as surface
+	uint32_t cube = (uint32_t)offset;
+	m_parent[cube] = cube;
+	m_sets[cube] = { 1, (uint64_t)solidFaces };
+	m_surface += solidFaces;
+	++m_voidVolume;
+
+	uint32_t exteriorRoot = find(m_exterior);
+	bool exterior = false;
+	for (int r = 0; r < nRoots; r++)
+		exterior |= (roots[r] == exteriorRoot);
+	bool breached = exterior && (nRoots > 1);	// An enclosed cavity joins the exterior
+	if (breached)
+		m_breaches += nRoots - 1;
+
+	for (int r = 0; r < nRoots; r++)
+		unite(cube, roots[r]);
+
+	return(breached);
+}
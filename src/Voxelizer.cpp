@@ -0,0 +1,323 @@
+/*-----------------------------------------------------------------------------------
+	MIT License
+
+	Copyright 2021 Robert L Eastwood
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy of this
+	software and associated documentation files (the "Software"), to deal in the Software
+	without restriction, including without limitation the rights to use, copy, modify,
+	merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+	permit persons to whom the Software is furnished to do so, subject to the following
+	conditions:
+
+	The above copyright notice and this permission notice shall be included in all copies
+	or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+	INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+	PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+	FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+	OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+	DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------------*/
+
+
+#include <math.h>
+#include <algorithm>
+
+#include "Voxelizer.h"
+#include "Parallel.h"
+
+// Converts the continuous interval [xa, xb] into the inclusive range of cubes whose centres it contains
+static bool centreRange(double xa, double xb, int& x0, int& x1)
+{
+	x0 = (int)ceil(xa - 0.5);
+	x1 = (int)floor(xb - 0.5);
+	return(x0 <= x1);
+}
+
+/****************************************************/
+/* Primitives										*/
+/****************************************************/
+ShapeBox::ShapeBox(int x0, int y0, int z0, int x1, int y1, int z1) :
+	m_x0(x0), m_y0(y0), m_z0(z0), m_x1(x1), m_y1(y1), m_z1(z1)
+{
+}
+
+void ShapeBox::getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const
+{
+	xmin = m_x0; ymin = m_y0; zmin = m_z0;
+	xmax = m_x1; ymax = m_y1; zmax = m_z1;
+}
+
+void ShapeBox::getRuns(int y, int z, RunList& runs) const
+{
+	if ((y < m_y0) || (y > m_y1) || (z < m_z0) || (z > m_z1))
+		return;
+	runs.push_back(std::make_pair(m_x0, m_x1));
+}
+
+ShapeSuperellipsoid::ShapeSuperellipsoid(double cx, double cy, double cz, double a, double b, double c, double e1/*=1.0*/, double e2/*=1.0*/) :
+	m_cx(cx), m_cy(cy), m_cz(cz), m_a(a), m_b(b), m_c(c), m_e1(e1), m_e2(e2)
+{
+}
+
+void ShapeSuperellipsoid::getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const
+{
+	xmin = (int)floor(m_cx - m_a); xmax = (int)ceil(m_cx + m_a);
+	ymin = (int)floor(m_cy - m_b); ymax = (int)ceil(m_cy + m_b);
+	zmin = (int)floor(m_cz - m_c); zmax = (int)ceil(m_cz + m_c);
+}
+
+void ShapeSuperellipsoid::getRuns(int y, int z, RunList& runs) const
+{
+	double zr = fabs((z + 0.5 - m_cz) / m_c);
+	double zterm = pow(zr, 2.0 / m_e1);
+	if (zterm > 1.0)
+		return;
+	double yr = fabs((y + 0.5 - m_cy) / m_b);
+	double xterm = pow(1.0 - zterm, m_e1 / m_e2) - pow(yr, 2.0 / m_e2);
+	if (xterm < 0.0)
+		return;
+	double half = m_a * pow(xterm, m_e2 / 2.0);
+
+	int x0, x1;
+	if (centreRange(m_cx - half, m_cx + half, x0, x1))
+		runs.push_back(std::make_pair(x0, x1));
+}
+
+ShapeEllipsoid::ShapeEllipsoid(double cx, double cy, double cz, double a, double b, double c) :
+	ShapeSuperellipsoid(cx, cy, cz, a, b, c)
+{
+}
+
+// Specialised to avoid the pow() calls of the general superellipsoid
+void ShapeEllipsoid::getRuns(int y, int z, RunList& runs) const
+{
+	double yr = (y + 0.5 - m_cy) / m_b;
+	double zr = (z + 0.5 - m_cz) / m_c;
+	double t = 1.0 - yr * yr - zr * zr;
+	if (t < 0.0)
+		return;
+	double half = m_a * sqrt(t);
+
+	int x0, x1;
+	if (centreRange(m_cx - half, m_cx + half, x0, x1))
+		runs.push_back(std::make_pair(x0, x1));
+}
+
+ShapeCylinder::ShapeCylinder(double cx, double cy, double cz, double ra, double rb, double halfLength, int axis/*=2*/) :
+	m_cx(cx), m_cy(cy), m_cz(cz), m_ra(ra), m_rb(rb), m_halfLength(halfLength), m_axis(axis)
+{
+}
+
+void ShapeCylinder::getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const
+{
+	double rx = (m_axis == 0) ? m_halfLength : m_ra;
+	double ry = (m_axis == 1) ? m_halfLength : ((m_axis == 0) ? m_ra : m_rb);
+	double rz = (m_axis == 2) ? m_halfLength : m_rb;
+	xmin = (int)floor(m_cx - rx); xmax = (int)ceil(m_cx + rx);
+	ymin = (int)floor(m_cy - ry); ymax = (int)ceil(m_cy + ry);
+	zmin = (int)floor(m_cz - rz); zmax = (int)ceil(m_cz + rz);
+}
+
+void ShapeCylinder::getRuns(int y, int z, RunList& runs) const
+{
+	double py = y + 0.5 - m_cy;
+	double pz = z + 0.5 - m_cz;
+	double xa, xb;
+	switch (m_axis) {
+	case 0:		// Axis along x: the row is either entirely inside or outside the cross section
+	{
+		double u = py / m_ra;
+		double v = pz / m_rb;
+		if ((u * u + v * v) > 1.0)
+			return;
+		xa = m_cx - m_halfLength;
+		xb = m_cx + m_halfLength;
+		break;
+	}
+	case 1:		// Axis along y: cross section in x,z
+	{
+		if (fabs(py) > m_halfLength)
+			return;
+		double v = pz / m_rb;
+		double t = 1.0 - v * v;
+		if (t < 0.0)
+			return;
+		double half = m_ra * sqrt(t);
+		xa = m_cx - half;
+		xb = m_cx + half;
+		break;
+	}
+	default:	// Axis along z: cross section in x,y
+	{
+		if (fabs(pz) > m_halfLength)
+			return;
+		double v = py / m_rb;
+		double t = 1.0 - v * v;
+		if (t < 0.0)
+			return;
+		double half = m_ra * sqrt(t);
+		xa = m_cx - half;
+		xb = m_cx + half;
+		break;
+	}
+	}
+
+	int x0, x1;
+	if (centreRange(xa, xb, x0, x1))
+		runs.push_back(std::make_pair(x0, x1));
+}
+
+/****************************************************/
+/* Constructive solid geometry						*/
+/****************************************************/
+ShapeCSG::ShapeCSG(Operation op, Shape* a, Shape* b) : m_op(op), m_a(a), m_b(b)
+{
+}
+
+ShapeCSG::~ShapeCSG()
+{
+	delete m_a;
+	delete m_b;
+}
+
+void ShapeCSG::getBounds(int& xmin, int& ymin, int& zmin, int& xmax, int& ymax, int& zmax) const
+{
+	m_a->getBounds(xmin, ymin, zmin, xmax, ymax, zmax);
+	if (m_op == DIFFERENCE)
+		return;		// Never larger than the first operand
+
+	int bxmin, bymin, bzmin, bxmax, bymax, bzmax;
+	m_b->getBounds(bxmin, bymin, bzmin, bxmax, bymax, bzmax);
+	if (m_op == UNION)
+	{
+		xmin = std::min(xmin, bxmin); ymin = std::min(ymin, bymin); zmin = std::min(zmin, bzmin);
+		xmax = std::max(xmax, bxmax); ymax = std::max(ymax, bymax); zmax = std::max(zmax, bzmax);
+	}
+	else
+	{
+		xmin = std::max(xmin, bxmin); ymin = std::max(ymin, bymin); zmin = std::max(zmin, bzmin);
+		xmax = std::min(xmax, bxmax); ymax = std::min(ymax, bymax); zmax = std::min(zmax, bzmax);
+	}
+}
+
+// Combines the sorted runs of both operands with a single merge pass
+void ShapeCSG::getRuns(int y, int z, RunList& runs) const
+{
+	RunList a, b;
+	m_a->getRuns(y, z, a);
+	if (a.empty() && (m_op != UNION))
+		return;		// Nothing to subtract from or intersect with
+	m_b->getRuns(y, z, b);
+
+	size_t i = 0, j = 0;
+	switch (m_op) {
+	case UNION:
+		while ((i < a.size()) || (j < b.size()))
+		{
+			std::pair<int, int> run;
+			if ((j == b.size()) || ((i < a.size()) && (a[i].first <= b[j].first)))
+				run = a[i++];
+			else
+				run = b[j++];
+			if (!runs.empty() && (run.first <= runs.back().second + 1))
+				runs.back().second = std::max(runs.back().second, run.second);	// Overlapping or touching runs are coalesced
+			else
+				runs.push_back(run);
+		}
+		break;
+
+	case INTERSECTION:
+		while ((i < a.size()) && (j < b.size()))
+		{
+			int x0 = std::max(a[i].first, b[j].first);
+			int x1 = std::min(a[i].second, b[j].second);
+			if (x0 <= x1)
+				runs.push_back(std::make_pair(x0, x1));
+			if (a[i].second < b[j].second)	// Advance whichever run ends first
+				++i;
+			else
+				++j;
+		}
+		break;
+
+	case DIFFERENCE:
+		for (i = 0; i < a.size(); i++)
+		{
+			int x0 = a[i].first;
+			int x1 = a[i].second;
+			while ((j < b.size()) && (b[j].second < x0))
+				++j;	// Skip subtracted runs entirely to the left
+			size_t k = j;
+			while ((k < b.size()) && (b[k].first <= x1) && (x0 <= x1))
+			{
+				if (b[k].first > x0)
+					runs.push_back(std::make_pair(x0, b[k].first - 1));
+				x0 = b[k].second + 1;
+				++k;
+			}
+			if (x0 <= x1)
+				runs.push_back(std::make_pair(x0, x1));
+		}
+		break;
+	}
+}
+
+/****************************************************/
+/* Voxelisation										*/
+/****************************************************/
+void voxelize(const Shape& shape, int xdim, int ydim, int zdim, unsigned int nThreads, SpanList& spans)
+{
+	int xmin, ymin, zmin, xmax, ymax, zmax;
+	shape.getBounds(xmin, ymin, zmin, xmax, ymax, zmax);
+	ymin = std::max(ymin, 0); ymax = std::min(ymax, ydim - 1);
+	zmin = std::max(zmin, 0); zmax = std::min(zmax, zdim - 1);
+	if ((ymin > ymax) || (zmin > zmax))
+		return;
+
+	int nRows = (ymax - ymin + 1) * (zmax - zmin + 1);
+	int rowWidth = ymax - ymin + 1;
+
+	// Each thread voxelises a contiguous block of rows into its own list.
+	// The lists are then concatenated in thread order which keeps the spans in z, y, x order.
+	std::vector<SpanList> threadSpans(nThreads ? nThreads : 1);
+	parallelFor(nRows, nThreads, [&](int64_t begin, int64_t end, unsigned int thread)
+	{
+		SpanList& local = threadSpans[thread];
+		RunList runs;
+		for (int64_t row = begin; row < end; row++)
+		{
+			int y = ymin + (int)(row % rowWidth);
+			int z = zmin + (int)(row / rowWidth);
+			runs.clear();
+			shape.getRuns(y, z, runs);
+			for (size_t i = 0; i < runs.size(); i++)
+			{
+				Span span;
+				span.x0 = std::max(runs[i].first, 0);
+				span.x1 = std::min(runs[i].second, xdim - 1);
+				span.y = y;
+				span.z = z;
+				if (span.x0 <= span.x1)
+					local.push_back(span);
+			}
+		}
+	});
+
+	size_t total = spans.size();
+	for (size_t t = 0; t < threadSpans.size(); t++)
+		total += threadSpans[t].size();
+	spans.reserve(total);
+	for (size_t t = 0; t < threadSpans.size(); t++)
+		spans.insert(spans.end(), threadSpans[t].begin(), threadSpans[t].end());
+}
+
+uint64_t spanVolume(const SpanList& spans)
+{
+	uint64_t volume = 0;
+	for (size_t i = 0; i < spans.size(); i++)
+		volume += (uint64_t)(spans[i].x1 - spans[i].x0 + 1);
+	return(volume);
+}